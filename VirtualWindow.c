@@ -1,8 +1,24 @@
+/* Build with:
+ * gcc VirtualWindow.c -o VirtualWindow -lm `pkg-config --cflags --libs gtk+-3.0 gstreamer-1.0 gstreamer-video-1.0 gstreamer-app-1.0 gstreamer-net-1.0 gstreamer-rtsp-server-1.0 gio-unix-2.0` */
+
 #include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
 #include <gtk/gtk.h>
 #include <gst/gst.h>
+#include <gst/video/video.h>
 #include <gst/video/videooverlay.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/net/gstnet.h>
 
 #include <gst/rtsp-server/rtsp-server.h>
 
@@ -17,509 +33,4566 @@
 
 #define DEFAULT_RTSP_PORT "8554"
 static char *port= (char *) DEFAULT_RTSP_PORT;
+static gchar *server_address = "10.252.61.91";  /* address the rtsp server binds to */
+static gboolean use_server = FALSE;       /* serve the capture devices of the [mount NAME] groups */
+static gint64 startup_time;               /* monotonic time main started */
 
-/* Structure to contain all our information, so we can pass it around */
-typedef struct _CustomData {
-  GstElement *videoStreamUschl;           /* Pipeline for the live stream from Unterschleißheim */
-  GstElement *waitingVideoUschl;          /* Pipeline for waiting video for Unterschleißheim video window */
+/* Milliseconds to wait before a failed or finished live stream is started again. The first retry is fast,
+ * every further failure doubles the delay up to RECONNECT_DELAY_MAX, the first decoded frame resets it */
+#define RECONNECT_DELAY_MIN 250
+#define RECONNECT_DELAY_MAX 10000
 
-  GstElement *videoStreamUlm;			 /* Pipeline for the live stream from Ulm */
-  GstElement *waitingVideoUlm;			 /* Pipeline for waiting video for Ulm video window */
+/* Connects a live stream pipeline is reused for before it is disposed of and built again, see stream_pipeline_acquire */
+#define PIPELINE_REUSE_MAX 100
 
-  GstState stateStreamUschl;                 /* Current state of the pipeline */
-  GstState stateStreamUlm;                 /* Current state of the pipeline */
-  gint64 duration;                /* Duration of the clip, in nanoseconds */
+/* The rate the waiting video ("snow") is played at */
+#define PLACEHOLDER_FRAMERATE 30
 
-  GstBus *busWaitingUschl;				/* pipeline bus monitoring Unterschleißheim waiting stream */
-  GstBus *busStreamUschl;				/* pipeline bus monitoring Unterschleißheim stream */
-  GstBus *busStreamUlm;		/* pipeline bus monitoring Ulm stream */
-  GstBus *busWaitingUlm;		/* pipeline bus monitoring Ulm waiting stream */
-} CustomData;
+/* Defaults of the per stream settings of the configuration file. Codec elements set to "auto" (or not set)
+ * are chosen by the startup probe */
+#define DEFAULT_LATENCY 10
+#define DEFAULT_LATENCY_MAX 500
+#define DEFAULT_TARGET_LOSS 1.0
+#define DEFAULT_RETRANSMISSION_LOSS 5.0
+#define CODEC_AUTO "auto"
+#define SCALER_NONE "none"
 
-/* global window_handle pointer (needed for linking our glimagsink to the gui window */
-static guintptr window_handle_Uschl = 0;
-static guintptr window_handle_Ulm = 0;
+/* The adaptive latency controller measures the loss rate over at least this many RTP packets, and lowers the latency
+ * only after this many of those windows in a row stayed below a quarter of the target loss */
+#define ADAPT_WINDOW_PACKETS 500
+#define ADAPT_QUIET_WINDOWS 5
 
-/* Definition of functions to start video streams */
-static gboolean rtsp_client_Uschl (CustomData *data);
-static gboolean rtsp_client_Ulm (CustomData *data);
+/* Milliseconds each codec element is measured for by the startup probe, and the frames the encoders are fed */
+#define CODEC_PROBE_TIME 1000
+#define CODEC_PROBE_FRAMES 60
 
-/* This function is called when the glimagesink element posts a prepare-window-handle message
- * -> bus sync handler will be called from the streaming thread directly
- * in this function we tell glimagesink to render on existing application window (window_handle)
- * needed because glimagesink element itself is created asynchronously from a GStreamer streaming thread some time after the pipeline has been started up */
-static GstBusSyncReply bus_sync_handler_Uschl (GstBus * bus, GstMessage * message, gpointer user_data){
-   GstVideoOverlay *overlay;
- /* ignore anything but 'prepare-window-handle' element messages */
- if (!gst_is_video_overlay_prepare_window_handle_message (message)){
-   return GST_BUS_PASS;
- }
- if (window_handle_Uschl != 0) {
-   /* GST_MESSAGE_SRC (message) will be the video sink element */
-   overlay = GST_VIDEO_OVERLAY (GST_MESSAGE_SRC (message));
-   gst_video_overlay_set_window_handle (overlay, window_handle_Uschl);
- } else {
-   g_warning ("Should have obtained window_handle by now!");
- }
- gst_message_unref (message);
- return GST_BUS_DROP;
-}
-
-/* Same function for second video window */
-static GstBusSyncReply bus_sync_handler_Ulm (GstBus * bus, GstMessage * message, gpointer user_data){
-	GstVideoOverlay *overlay;
- /* ignore anything but 'prepare-window-handle' element messages */
- if (!gst_is_video_overlay_prepare_window_handle_message (message)){
-   return GST_BUS_PASS;
- }
- if (window_handle_Ulm != 0) {
-   /* GST_MESSAGE_SRC (message) will be the video sink element */
-   overlay = GST_VIDEO_OVERLAY (GST_MESSAGE_SRC (message));
-   gst_video_overlay_set_window_handle (overlay, window_handle_Ulm);
- } else {
-   g_warning ("Should have obtained window_handle by now!");
- }
- gst_message_unref (message);
- return GST_BUS_DROP;
-}
+/* Frames a new connection drops while it waits for a keyframe, after that it decodes whatever comes. This covers
+ * cameras that never send IDR frames (intra refresh) */
+#define KEYFRAME_WAIT_FRAMES 90
 
-/* This function is called when the GUI toolkit creates the physical window that will hold the video.
- * At this point we can retrieve its handler (which has a different meaning depending on the windowing system)
- * and pass it to GStreamer through the VideoOverlay interface. */
-static void realize_cb_Uschl (GtkWidget *widget, CustomData *data) {
-  GdkWindow *window = gtk_widget_get_window (widget);
+/* Milliseconds without a live frame after which a tile falls back to the waiting video, and how often that is checked */
+#define NO_DATA_TIMEOUT 1000
+#define NO_DATA_CHECK_INTERVAL 100
 
-  if (!gdk_window_ensure_native (window))
-    g_error ("Couldn't create native window needed for GstVideoOverlay!");
+/* Milliseconds without a frame out of the depayloader after which a live stream counts as stalled and is reconnected,
+ * and how often each stream checks that */
+#define STALL_TIMEOUT 5000
+#define STALL_CHECK_INTERVAL 500
 
-  /* Retrieve window handler from GDK */
-#if defined (GDK_WINDOWING_WIN32)
-  window_handle_Uschl = (guintptr)GDK_WINDOW_HWND (window);
-#elif defined (GDK_WINDOWING_QUARTZ)
-  window_handle_Uschl = gdk_quartz_window_get_nsview (window);
-#elif defined (GDK_WINDOWING_X11)
-  window_handle_Uschl = GDK_WINDOW_XID (window);
-#endif
+/* Milliseconds from the capture of a frame until all tiles show it in synced mode, unless sync-latency is set */
+#define DEFAULT_SYNC_LATENCY 300
+/* Port of the NTP server the shared clock of synced mode follows */
+#define NTP_PORT 123
 
-  /* Pass it to videoStreamUschl, which implements VideoOverlay and will forward it to the video sink */
-  gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (data->waitingVideoUschl), window_handle_Uschl);
-  gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (data->videoStreamUschl), window_handle_Uschl);
-}
+/* Port on the loopback interface the metrics are served on, 0 to serve them on the metrics socket only */
+#define DEFAULT_METRICS_PORT 9101
+/* Ceiling of the size of a metrics request, it is not looked at beyond the request line */
+#define METRICS_REQUEST_SIZE 1024
+/* Glass-to-glass latencies above this many seconds come from clocks that are not synchronised and are not counted */
+#define LATENCY_MAX 60
 
-/* same function for second video window */
-static void realize_cb_Ulm (GtkWidget *widget, CustomData *data) {
-  GdkWindow *window = gtk_widget_get_window (widget);
+/* Defaults of the recording: length in seconds of the segments the ring is cut into, of the ring itself,
+ * and of the clip saved from it on SIGUSR1 */
+#define DEFAULT_RECORD_SEGMENT 10
+#define DEFAULT_RECORD_LENGTH 300
+#define DEFAULT_RECORD_SAVE 60
+/* Milliseconds of video the recording branch buffers before it drops frames, so a slow disk never holds up the tile */
+#define RECORD_QUEUE_TIME 2000
 
-  if (!gdk_window_ensure_native (window))
-    g_error ("Couldn't create native window needed for GstVideoOverlay!");
+/* Mount path prefix of the relays of the streams on the rtsp server, followed by the name of the site */
+#define RELAY_PATH "/relay/"
+/* Milliseconds of H.264 the relay branch buffers before it drops frames, so a slow relay never holds up the tile */
+#define RELAY_QUEUE_TIME 500
 
-  /* Retrieve window handler from GDK */
-#if defined (GDK_WINDOWING_WIN32)
-  window_handle_Ulm = (guintptr)GDK_WINDOW_HWND (window);
-#elif defined (GDK_WINDOWING_QUARTZ)
-  window_handle_Ulm = gdk_quartz_window_get_nsview (window);
-#elif defined (GDK_WINDOWING_X11)
-  window_handle_Ulm = GDK_WINDOW_XID (window);
-#endif
+/* Milliseconds per connect/fail cycle of --soak, cycles before the baseline of memory and file descriptors is taken,
+ * and how far above the baseline they may end up: kilobytes of resident memory, file descriptors */
+#define SOAK_CYCLE_INTERVAL 250
+#define SOAK_WARMUP 50
+#define SOAK_RSS_SLACK 8192
+#define SOAK_FD_SLACK 8
+
+/* Seconds the benchmark waits for all streams to start or to recover before it gives up on them */
+#define BENCH_PHASE_TIMEOUT 15
+
+/* Size of the picture the mixer renders in compositor mode, glimagesink scales it to the window */
+#define WALL_WIDTH 1920
+#define WALL_HEIGHT 1080
+
+/* Settings of the whole node. They are read from the [general] group of the configuration file,
+ * the command line overrides them. Changes in the file need a restart to take effect */
+static gboolean use_compositor = FALSE;   /* render all tiles through one mixer pipeline into a single window */
+static gchar *mixer_element = NULL;       /* mixer used in compositor mode, glvideomixer if not set */
+static gboolean use_standby = FALSE;      /* reconnect through a second pipeline that is only shown once it decodes */
+static gint no_data_timeout = -1;         /* milliseconds without live frames before the waiting video is shown, -1 if not set */
+static gint stall_timeout = -1;           /* milliseconds without frames before a stream is reconnected, -1 if not set, 0 never */
+static gchar *placeholder_location = "/home/pi/test.h264"; /* the waiting video shown on every tile whose live stream is down */
+static gchar *placeholder_decoder = NULL; /* decoder of the waiting video, chosen by the probe if not set */
+static gint placeholder_crop_right = 275; /* pixels cropped off the waiting video */
+static gint placeholder_crop_bottom = 75;
+static gchar *scaler_element = NULL;      /* scales the decoded frames down to their tiles, chosen by scaler_choose if not set */
+static gint metrics_port = -1;            /* TCP port of the metrics endpoint, -1 if not set, 0 to disable it */
+static gchar *metrics_socket = NULL;      /* Unix socket the metrics are served on as well */
+static gchar *control_socket = NULL;      /* Unix socket control commands are accepted on, none if not set */
+static gchar *record_directory = "/var/lib/virtualwindow/record"; /* the segment rings and the saved clips */
+static gint record_segment = DEFAULT_RECORD_SEGMENT; /* seconds per segment of the ring */
+static gint record_length = DEFAULT_RECORD_LENGTH; /* seconds the ring keeps */
+static gint record_save_length = DEFAULT_RECORD_SAVE; /* seconds saved into a clip on SIGUSR1 */
+static gboolean use_sync = FALSE;         /* show the frames of all tiles in step, by their capture time, see sync_clock */
+static gint sync_latency = -1;            /* milliseconds from capture to display in synced mode, -1 if not set */
+static gchar *ntp_server = NULL;          /* NTP server the shared clock follows, the system clock is used if not set */
+static GstClock *sync_clock = NULL;       /* clock of all live stream pipelines in synced mode, see sync_clock_create */
+static GstClockTime sync_clock_offset = 0; /* NTP time of sync_clock time 0 */
+static GKeyFile *config_running = NULL;   /* the configuration as read at startup, reload_cb compares [general] with it */
+
+/* Command line only options, the per stream ones override the configuration file for every stream */
+static gchar *config_file = NULL;         /* configuration file, the built-in default_config if not set */
+static gchar **stream_locations = NULL;   /* NAME=URL pairs overriding or adding streams */
+static gint stream_latency = -1;          /* jitterbuffer latency of all streams, -1 if not set */
+static gchar *stream_decoder = NULL;      /* decoder of all streams */
+static gboolean stream_record = FALSE;    /* record all streams */
+static gboolean stream_relay = FALSE;     /* relay all streams */
 
-  /* Pass it to videoStreamUschl, which implements VideoOverlay and will forward it to the video sink */
-  gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (data->videoStreamUlm), window_handle_Ulm);
-  gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (data->waitingVideoUlm), window_handle_Ulm);
+/* Benchmark options: streams served by an in-process rtsp server on localhost instead of the sites */
+static gboolean benchmark = FALSE;        /* run headless against the synthetic streams and report */
+static gint bench_streams = 4;            /* number of synthetic streams */
+static gint bench_width = 1280;           /* picture size of the synthetic streams */
+static gint bench_height = 720;
+static gint bench_bitrate = 2000;         /* kbit/s of the synthetic streams */
+static gdouble bench_loss = 0;            /* percentage of RTP packets the server drops */
+static gint bench_duration = 20;          /* seconds the steady state is measured for */
+static gint soak_cycles = 0;              /* connect/fail cycles of the soak test, 0 for none */
+
+static GOptionEntry bench_entries[] = {
+  { "benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark, "Run headless against synthetic streams of an in-process rtsp server and report", NULL },
+  { "bench-streams", 0, 0, G_OPTION_ARG_INT, &bench_streams, "Number of synthetic streams (default 4)", "N" },
+  { "bench-width", 0, 0, G_OPTION_ARG_INT, &bench_width, "Width of the synthetic streams (default 1280)", "PIXELS" },
+  { "bench-height", 0, 0, G_OPTION_ARG_INT, &bench_height, "Height of the synthetic streams (default 720)", "PIXELS" },
+  { "bench-bitrate", 0, 0, G_OPTION_ARG_INT, &bench_bitrate, "Bitrate of the synthetic streams in kbit/s (default 2000)", "KBPS" },
+  { "bench-loss", 0, 0, G_OPTION_ARG_DOUBLE, &bench_loss, "Percentage of RTP packets the server drops (default 0)", "PERCENT" },
+  { "bench-duration", 0, 0, G_OPTION_ARG_INT, &bench_duration, "Seconds the steady state is measured for (default 20)", "SECONDS" },
+  { "soak", 0, 0, G_OPTION_ARG_INT, &soak_cycles, "Run headless through this many connect/fail cycles of the synthetic streams and check that memory and file descriptors stay flat", "CYCLES" },
+  { NULL }
+};
+
+static GOptionEntry entries[] = {
+  { "config", 'f', 0, G_OPTION_ARG_FILENAME, &config_file, "Configuration file, reloaded on SIGHUP", "FILE" },
+  { "stream", 'u', 0, G_OPTION_ARG_STRING_ARRAY, &stream_locations, "Set the location of stream NAME, adds the stream if it is not configured (repeatable)", "NAME=URL" },
+  { "latency", 'l', 0, G_OPTION_ARG_INT, &stream_latency, "Jitterbuffer latency of all streams in milliseconds", "MS" },
+  { "decoder", 'd', 0, G_OPTION_ARG_STRING, &stream_decoder, "H.264 decoder element of all streams, auto for the fastest one available", "ELEMENT" },
+  { "compositor", 'c', 0, G_OPTION_ARG_NONE, &use_compositor, "Render all tiles through one mixer pipeline into a single window", NULL },
+  { "mixer", 'm', 0, G_OPTION_ARG_STRING, &mixer_element, "Mixer element used in compositor mode (glvideomixer or compositor)", "ELEMENT" },
+  { "standby", 's', 0, G_OPTION_ARG_NONE, &use_standby, "Reconnect through a standby pipeline negotiating in the background, shown on its first decoded frame", NULL },
+  { "no-data-timeout", 't', 0, G_OPTION_ARG_INT, &no_data_timeout, "Milliseconds without live frames before a tile shows the waiting video (default 1000)", "MS" },
+  { "stall-timeout", 0, 0, G_OPTION_ARG_INT, &stall_timeout, "Milliseconds without frames before a stalled stream is reconnected, 0 never (default 5000)", "MS" },
+  { "sync", 'y', 0, G_OPTION_ARG_NONE, &use_sync, "Show the frames of all tiles in step by their capture time, from the RTCP sender reports", NULL },
+  { "sync-latency", 0, 0, G_OPTION_ARG_INT, &sync_latency, "Milliseconds from capture to display in synced mode (default 300)", "MS" },
+  { "ntp-server", 0, 0, G_OPTION_ARG_STRING, &ntp_server, "NTP server the clock of synced mode follows, the system clock if not set", "HOST" },
+  { "server", 'S', 0, G_OPTION_ARG_NONE, &use_server, "Serve the capture devices configured as [mount NAME] groups over rtsp", NULL },
+  { "metrics-port", 'p', 0, G_OPTION_ARG_INT, &metrics_port, "Serve Prometheus metrics on this port of the loopback interface, 0 to disable (default 9101)", "PORT" },
+  { "metrics-socket", 0, 0, G_OPTION_ARG_FILENAME, &metrics_socket, "Serve Prometheus metrics on this Unix socket", "PATH" },
+  { "control-socket", 0, 0, G_OPTION_ARG_FILENAME, &control_socket, "Accept control commands on this Unix socket, send it help for the list", "PATH" },
+  { "record", 'r', 0, G_OPTION_ARG_NONE, &stream_record, "Record all streams into a ring of segments on disk, SIGUSR1 saves the end of each ring into a clip", NULL },
+  { "relay", 'R', 0, G_OPTION_ARG_NONE, &stream_relay, "Re-serve all streams on the rtsp server at " RELAY_PATH "NAME, without transcoding", NULL },
+  { NULL }
+};
+
+/* Configuration used when no configuration file is given. Every [stream NAME] group is one tile,
+ * see VirtualWindow.conf for all keys */
+static const gchar default_config[] =
+  "[stream Uschl]\n"                       /* Unterschleißheim */
+  "location=rtsp://10.252.61.91:8554/test\n"
+  "user-id=user\n"
+  "user-pw=password\n"
+  "[stream Ulm]\n"                         /* Ulm */
+  "location=rtsp://10.252.61.135:8554/test\n"
+  "user-id=user\n"
+  "user-pw=password\n";
+
+/* Description of one site whose live stream is shown in its own tile of the video wall */
+typedef struct _StreamSite {
+  gchar *name;                    /* Short name of the site, used in log messages */
+  gchar *location;                /* RTSP url of the camera server at this site */
+  gchar *user_id;                 /* RTSP credentials, NULL if the server needs none */
+  gchar *user_pw;
+  gchar *decoder;                 /* H.264 decoder element, NULL to use the fastest one available */
+  guint latency;                  /* rtpjitterbuffer latency in milliseconds, the one the stream starts with */
+  gboolean drop_on_latency;       /* drop packets arriving later than latency instead of waiting for them */
+  gboolean adaptive_latency;      /* adjust the latency to the loss observed, between latency_min and latency_max */
+  gint latency_min;               /* -1 for latency */
+  guint latency_max;
+  gdouble target_loss;            /* percentage of lost and late packets the controller aims for */
+  gdouble retransmission_loss;    /* percentage of loss above which retransmission is requested, 0 never */
+  guint startup_delay;            /* Seconds to wait after startup before connecting */
+  gboolean record;                /* keep the last record_length seconds of the stream on disk */
+  gboolean relay;                 /* re-serve the stream on the rtsp server of this node, read when the stream is created */
+  gint row;                       /* Placement of the tile, -1 to place it automatically */
+  gint column;
+} StreamSite;
+
+typedef struct _CustomData CustomData;
+
+/* What reaches the decoder of a stream, depending on whether its tile can be seen, see decode_probe_cb */
+typedef enum {
+  DECODE_ALL,                     /* Tile visible: every frame */
+  DECODE_NONE,                    /* Tile hidden: nothing, the stream is only depayloaded and parsed */
+  DECODE_RESUME,                  /* Tile visible again: nothing yet, the next frame requests a keyframe */
+  DECODE_KEYFRAME                 /* Nothing until the keyframe arrives, then every frame again */
+} DecodeState;
+
+/* The relay of a stream: the parsed H.264 of its live stream pipeline, re-served without transcoding by a shared mount
+ * of the rtsp server to any number of clients. The stream and the media of the mount hold a reference each, the rtsp
+ * server may keep the media a little longer than the stream lives */
+typedef struct _StreamRelay {
+  gchar *path;                    /* Mount path on the rtsp server */
+  GMutex lock;                    /* protects appsrc, caps and keyframe */
+  GstElement *appsrc;             /* appsrc of the media being served, NULL while nobody watches */
+  GstCaps *caps;                  /* caps last set on appsrc */
+  gboolean keyframe;              /* Clients just joined, the next frame requests a keyframe for them */
+} StreamRelay;
+
+/* Upper bounds in milliseconds of the glass-to-glass latency histogram buckets */
+static const guint latency_buckets[] = { 20, 50, 100, 200, 500, 1000, 2000 };
+
+/* Counters of one stream, summed over all its pipelines. The streaming threads update them with atomic adds
+ * from pad probes and the metrics endpoint reads them without taking a lock. The fields are read by offset
+ * in metrics_append, so they are all guint64 */
+typedef struct _StreamMetrics {
+  guint64 packets;                /* RTP packets out of the jitterbuffer */
+  guint64 bytes;                  /* RTP payload bytes out of the jitterbuffer */
+  guint64 received;               /* Frames out of the depayloader */
+  guint64 decoded;                /* Frames out of the decoder */
+  guint64 shown;                  /* Frames handed to the tile */
+  guint64 reconnects;             /* Reconnects scheduled */
+  guint64 latency_count;          /* Frames whose glass-to-glass latency was measured */
+  guint64 latency_sum;            /* Sum of those latencies in microseconds */
+  guint64 latency_bucket[G_N_ELEMENTS (latency_buckets)]; /* Frames per latency bucket, not cumulative */
+  guint64 latency_last;           /* Latency of the last frame measured, in microseconds */
+  guint64 fps;                    /* Frames decoded during the last second, updated by metrics_update_cb */
+  guint64 decoded_before;         /* decoded one second ago */
+  guint64 jitterbuffer_percent;   /* Fill level of the jitterbuffer of the pipeline shown */
+  guint64 lost;                   /* RTP packets its jitterbuffer gave up on */
+  guint64 late;                   /* RTP packets that arrived after their latency */
+  guint64 latency;                /* Current jitterbuffer latency in milliseconds */
+  guint64 first_frame;            /* Microseconds from the last connect to its first decoded frame */
+  guint64 stalls;                 /* Stalls detected by stream_stall_check_cb */
+  guint64 stall_time;             /* Microseconds the stream was stalled, from its last frame to the first one after it */
+  guint64 stall_last;             /* Microseconds the last stall that ended lasted */
+  guint64 age;                    /* Microseconds from the capture of the last frame handed to the tile until then */
+} StreamMetrics;
+
+#define METRIC_ADD(field, value) __atomic_add_fetch (&(field), (value), __ATOMIC_RELAXED)
+#define METRIC_SET(field, value) __atomic_store_n (&(field), (value), __ATOMIC_RELAXED)
+#define METRIC_GET(field) __atomic_load_n (&(field), __ATOMIC_RELAXED)
+
+/* Structure to contain everything that belongs to one stream and its tile on the screen */
+typedef struct _VideoStream {
+  guint index;                    /* Number of the tile, names its elements in the compositor pipeline */
+  guint row;                      /* Position of the tile in the video wall */
+  guint column;
+  StreamSite *site;               /* Site this stream is coming from, owned by the stream. Only replaced by the main thread */
+
+  /* Control thread of the stream. The live stream pipelines, their bus watches and the reconnects of the stream
+   * are handled on context by thread only, so a stream tearing down never holds up the GUI or the other streams */
+  GMainContext *context;
+  GMainLoop *loop;
+  GThread *thread;
+  GSource *statsSource;           /* Reads the jitterbuffer statistics into metrics, see stream_stats_cb */
+  GSource *stallSource;           /* Watchdog of the data flow, see stream_stall_check_cb. NULL with a stall_timeout of 0 */
+
+  GstElement *videoStream;        /* Pipeline for the live stream. Set on the control thread only, the streaming threads
+                                   * compare against it with g_atomic_pointer_get */
+  GstElement *standbyStream;      /* Replacement pipeline negotiating in the background until it decodes its first frame (--standby only) */
+  gboolean replacing;             /* standbyStream connects while videoStream still plays and is shown, see stream_replace.
+                                   * Control thread only */
+  GstElement *display;            /* Pipeline rendering the tile on its own window (window mode only) */
+  GtkWidget *widget;              /* Drawing area of the tile (window mode only) */
+  GstElement *tile;               /* Bin of the tile inside the compositor pipeline (compositor mode only) */
+  GstPad *mixerPad;               /* Mixer pad the tile is placed on (compositor mode only) */
+  StreamRelay *relay;             /* Relay of the live stream, NULL if the site is not relayed. Set for the life of the stream */
+
+  GstState stateStream;           /* Current state of the live stream pipeline */
+
+  guintptr window_handle;         /* window handle of the tile (needed for linking our glimagesink to the gui window) */
+  GSource *reconnectSource;       /* Pending (re)connect of the live stream on context, NULL if none */
+  gint64 connectTime;             /* monotonic time the live stream was last started */
+  gint64 lastData;                /* monotonic time of the last frame out of the depayloader of videoStream, atomic */
+  gint64 stallStart;              /* monotonic time of the last frame before the current stall, 0 if none, atomic */
+  guint reconnect_delay;          /* Milliseconds the next reconnect waits, grows with every failure */
+  gint decoder_rank;              /* Decoder of the next pipeline: -1 for the one of the site, else the index in decoders */
+
+  /* Adaptive latency controller, see stream_adapt_latency. Control thread only */
+  guint latency;                  /* Current jitterbuffer latency in milliseconds */
+  gboolean retransmission;        /* Retransmission requested from the next connection on */
+  guint64 adaptPushed;            /* Jitterbuffer counters at the last look */
+  guint64 adaptLost;
+  guint64 adaptLate;
+  guint64 windowPackets;          /* Packets and lost or late ones of the current measuring window */
+  guint64 windowLoss;
+  guint quietWindows;             /* Windows in a row far below the target loss */
+
+  /* The tile itself: the live branch and the waiting video branch joined by an input-selector,
+   * inside display in window mode or inside the compositor pipeline in compositor mode */
+  GstElement *selector;           /* input-selector choosing what the tile shows */
+  GstPad *livePad;                /* selector pad of the live branch */
+  GstPad *waitPad;                /* selector pad of the waiting video branch */
+  GstElement *liveSrc;            /* appsrc of the live branch, fed by live_new_sample_cb */
+  GstCaps *liveCaps;              /* caps last set on liveSrc */
+  GstElement *waitSrc;            /* appsrc of the waiting video branch, fed by placeholder_new_sample_cb */
+  GstCaps *waitCaps;              /* caps last set on waitSrc */
+  gint showLive;                  /* TRUE while the selector shows the live branch */
+  gint decoding;                  /* DecodeState of the live stream pipelines, set by the main thread */
+  gint tileWidth;                 /* Size in pixels the tile is drawn at, 0 until known. Set by the main thread */
+  gint tileHeight;
+  gboolean tileHidden;            /* The drawing area of the tile is unmapped or fully covered, main thread only */
+  gint64 lastLiveFrame;           /* monotonic time of the last live frame */
+  GMutex liveLock;                /* protects liveSrc/liveCaps/lastLiveFrame, both live pipelines push during a standby switch */
+
+  StreamMetrics metrics;          /* Telemetry of the stream, served by the metrics endpoint */
+
+  /* Measurements of --benchmark */
+  gint64 firstFrameTime;          /* monotonic time the last (re)start decoded its first frame */
+  GArray *latencies;              /* glass-to-glass latency of every frame shown in microseconds, under liveLock */
+
+  CustomData *app;                /* Back pointer to the application data */
+} VideoStream;
+
+/* Structure to contain all our information, so we can pass it around */
+struct _CustomData {
+  GPtrArray *streams;             /* All VideoStream tiles of the video wall, in tile order */
+  GMutex streamsLock;             /* Held by the main thread to change streams, and by the placeholder pipeline to read it */
+  guint tiles;                    /* Tiles created so far, numbers the next one */
+  gint64 duration;                /* Duration of the clip, in nanoseconds */
+
+  GstElement *placeholder;        /* Pipeline decoding the waiting video once for all tiles */
+  guint no_data_check;            /* GSource id of no_data_check_cb */
+
+  GstElement *compositor;         /* Pipeline mixing all tiles into the single video window (compositor mode only) */
+  GstState stateCompositor;       /* Current state of the compositor pipeline */
+  guintptr window_handle;         /* window handle of the single video window (compositor mode only) */
+  gboolean iconified;             /* The main window is minimized or withdrawn, no tile can be seen */
+  GtkWidget *grid;                /* Grid holding the drawing areas of the tiles (window mode only) */
+  guint columns;                  /* Size of the grid of the tiles */
+  guint rows;
+
+  GstRTSPServer *server;          /* rtsp server side, NULL if not serving (--server only) */
+  GMainLoop *serverLoop;          /* Main loop of the rtsp server side, on its own context */
+  GThread *serverThread;          /* Thread running serverLoop */
+
+  GSocketService *metrics;        /* Endpoint serving the metrics of all streams, NULL if disabled */
+  GSocketService *control;        /* Endpoint of the control commands, NULL if disabled */
+  guint metrics_update;           /* GSource id of metrics_update_cb */
+};
+
+/* Create a site with the default settings */
+static StreamSite *site_new (const gchar *name) {
+  StreamSite *site = g_new0 (StreamSite, 1);
+
+  site->name = g_strdup (name);
+  site->latency = DEFAULT_LATENCY;
+  site->drop_on_latency = TRUE;
+  site->adaptive_latency = TRUE;
+  site->latency_min = -1;
+  site->latency_max = DEFAULT_LATENCY_MAX;
+  site->target_loss = DEFAULT_TARGET_LOSS;
+  site->retransmission_loss = DEFAULT_RETRANSMISSION_LOSS;
+  site->row = -1;
+  site->column = -1;
+  return site;
 }
 
-/* This function is called when the main window is closed */
-static void delete_event_cb (GtkWidget *widget, GdkEvent *event, CustomData *data) {
-  /* Set all pipelines to READY state (they are set to NULL at the end of the program) */
-  gst_element_set_state (data->waitingVideoUschl, GST_STATE_READY);
-  gst_element_set_state (data->videoStreamUschl, GST_STATE_READY);
-  gst_element_set_state (data->videoStreamUlm, GST_STATE_READY);
-  gst_element_set_state (data->waitingVideoUlm, GST_STATE_READY);
+static void site_free (StreamSite *site) {
+  g_free (site->name);
+  g_free (site->location);
+  g_free (site->user_id);
+  g_free (site->user_pw);
+  g_free (site->decoder);
+  g_free (site);
 }
 
-/* This function is called everytime the video window needs to be redrawn (due to damage/exposure,
- * rescaling, etc). GStreamer takes care of this in the PAUSED and PLAYING states, otherwise,
- * we simply draw a black rectangle to avoid garbage showing up. */
-static gboolean draw_cb_Uschl (GtkWidget *widget, cairo_t *cr, CustomData *data) {
-  GtkAllocation allocation;
-  if (data->stateStreamUschl < GST_STATE_PAUSED) {
-  gtk_widget_get_allocation(widget, &allocation);
-    cairo_set_source_rgb (cr, 0, 0, 0);
-    cairo_rectangle (cr, 0, 0, 950, 1040);
-    cairo_fill (cr);
-  }
- return FALSE;
+/* A copy of site, to give a stream different settings */
+static StreamSite *site_copy (const StreamSite *site) {
+  StreamSite *copy = g_new (StreamSite, 1);
+
+  *copy = *site;
+  copy->name = g_strdup (site->name);
+  copy->location = g_strdup (site->location);
+  copy->user_id = g_strdup (site->user_id);
+  copy->user_pw = g_strdup (site->user_pw);
+  copy->decoder = g_strdup (site->decoder);
+  return copy;
 }
 
-/* This function is called everytime the video window needs to be redrawn (due to damage/exposure,
- * rescaling, etc). GStreamer takes care of this in the PAUSED and PLAYING states, otherwise,
- * we simply draw a black rectangle to avoid garbage showing up. */
-static gboolean draw_cb_Ulm (GtkWidget *widget, cairo_t *cr, CustomData *data) {
-  GtkAllocation allocation;
-  if (data->stateStreamUlm < GST_STATE_PAUSED) {
-  gtk_widget_get_allocation(widget, &allocation);
-    cairo_set_source_rgb (cr, 0, 0, 0);
-    cairo_rectangle (cr, 0, 0, 950, 1040);
-    cairo_fill (cr);
+/* TRUE if both sites result in the same live stream pipeline. Placement, relaying and startup delay do not count,
+ * relaying needs a restart to change */
+static gboolean site_equal (const StreamSite *a, const StreamSite *b) {
+  return g_strcmp0 (a->location, b->location) == 0 && g_strcmp0 (a->user_id, b->user_id) == 0 &&
+      g_strcmp0 (a->user_pw, b->user_pw) == 0 && g_strcmp0 (a->decoder, b->decoder) == 0 &&
+      a->latency == b->latency && a->drop_on_latency == b->drop_on_latency && a->adaptive_latency == b->adaptive_latency &&
+      a->latency_min == b->latency_min && a->latency_max == b->latency_max && a->target_loss == b->target_loss &&
+      a->retransmission_loss == b->retransmission_loss && a->record == b->record;
+}
+
+static StreamSite *sites_find (GPtrArray *sites, const gchar *name) {
+  guint i;
+
+  for (i = 0; i < sites->len; i++) {
+    StreamSite *site = g_ptr_array_index (sites, i);
+
+    if (g_strcmp0 (site->name, name) == 0)
+      return site;
   }
- return FALSE;
+  return NULL;
 }
 
-/* This creates all the GTK+ widgets that compose our application, and registers the callbacks */
-static void create_ui (CustomData *data) {
-  GtkWidget *main_window;  /* The uppermost window, containing all other windows */
-  GtkWidget *video_window_Uschl; /* The drawing area where the video will be shown */
-  GtkWidget *video_window_Ulm; /* The drawing area where the video will be shown */
-  GtkWidget *main_box;     /* VBox to hold main_hbox and the controls */
-  GtkWidget *main_hbox;    /* HBox to hold the video_window and the stream info text widget */
+/* Replace *value with the string of key in group, if the key is there */
+static void key_file_update_string (GKeyFile *key_file, const gchar *group, const gchar *key, gchar **value) {
+  gchar *str = g_key_file_get_string (key_file, group, key, NULL);
 
-  main_window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
-  g_signal_connect (G_OBJECT (main_window), "delete-event", G_CALLBACK (delete_event_cb), data);
+  if (str) {
+    g_free (*value);
+    *value = str;
+  }
+}
 
-  video_window_Uschl = gtk_drawing_area_new();
-  gtk_widget_set_double_buffered (video_window_Uschl, FALSE);
-  g_signal_connect (video_window_Uschl, "realize", G_CALLBACK (realize_cb_Uschl), data);
-  g_signal_connect (video_window_Uschl, "draw", G_CALLBACK (draw_cb_Uschl), data);
+/* Replace *value with the codec element of key in group, if the key is there. "auto" becomes NULL */
+static void key_file_update_codec (GKeyFile *key_file, const gchar *group, const gchar *key, gchar **value) {
+  key_file_update_string (key_file, group, key, value);
+  if (g_strcmp0 (*value, CODEC_AUTO) == 0) {
+    g_free (*value);
+    *value = NULL;
+  }
+}
 
-  video_window_Ulm = gtk_drawing_area_new();
-  gtk_widget_set_double_buffered (video_window_Ulm, FALSE);
-  g_signal_connect (video_window_Ulm, "realize", G_CALLBACK (realize_cb_Ulm), data);
-  g_signal_connect (video_window_Ulm, "draw", G_CALLBACK (draw_cb_Ulm), data);
+/* Replace *value with the integer of key in group, if the key is there */
+static gboolean key_file_update_int (GKeyFile *key_file, const gchar *group, const gchar *key, gint *value, GError **error) {
+  GError *err = NULL;
+  gint i;
 
-  main_hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
-  gtk_box_pack_start (GTK_BOX (main_hbox), video_window_Uschl, TRUE, TRUE, 0);
-  gtk_box_pack_start (GTK_BOX (main_hbox), video_window_Ulm, TRUE, TRUE, 0);
+  if (!g_key_file_has_key (key_file, group, key, NULL))
+    return TRUE;
+  i = g_key_file_get_integer (key_file, group, key, &err);
+  if (err) {
+    g_propagate_error (error, err);
+    return FALSE;
+  }
+  *value = i;
+  return TRUE;
+}
 
-  main_box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
-  gtk_box_pack_start (GTK_BOX (main_box), main_hbox, TRUE, TRUE, 0);
-  gtk_container_add (GTK_CONTAINER (main_window), main_box);
-  gtk_window_set_default_size (GTK_WINDOW (main_window), 1920, 1080);
+/* Replace *value with the floating point number of key in group, if the key is there */
+static gboolean key_file_update_double (GKeyFile *key_file, const gchar *group, const gchar *key, gdouble *value, GError **error) {
+  GError *err = NULL;
+  gdouble d;
 
-  gtk_widget_show_all (main_window);
+  if (!g_key_file_has_key (key_file, group, key, NULL))
+    return TRUE;
+  d = g_key_file_get_double (key_file, group, key, &err);
+  if (err) {
+    g_propagate_error (error, err);
+    return FALSE;
+  }
+  *value = d;
+  return TRUE;
 }
 
+/* Replace *value with the boolean of key in group, if the key is there */
+static gboolean key_file_update_boolean (GKeyFile *key_file, const gchar *group, const gchar *key, gboolean *value, GError **error) {
+  GError *err = NULL;
+  gboolean b;
+
+  if (!g_key_file_has_key (key_file, group, key, NULL))
+    return TRUE;
+  b = g_key_file_get_boolean (key_file, group, key, &err);
+  if (err) {
+    g_propagate_error (error, err);
+    return FALSE;
+  }
+  *value = b;
+  return TRUE;
+}
 
+/* Read the [general] group into the node settings. Command line options that were given are kept */
+static gboolean config_load_general (GKeyFile *key_file, GError **error) {
+  gboolean compositor = FALSE, standby = FALSE, server = FALSE, sync = FALSE;
+  gint timeout = no_data_timeout;
+  gint stall = stall_timeout;
+  gint latency = DEFAULT_SYNC_LATENCY;
+  gint port_setting = DEFAULT_METRICS_PORT;
+  gchar *mixer = NULL;
 
-/* This function is called when an End-Of-Stream message is posted on the bus.
- * We just set the pipeline to READY (which stops playback) */
-static void eos_cb_Uschl (GstBus *bus, GstMessage *msg, CustomData *data) {
-  g_print ("End-Of-Stream reached.\n");
-  /* Set the streaming pipeline to ready state, wait 1 s to make sure pipeline is ready */
-  gst_element_set_state (data->videoStreamUschl, GST_STATE_READY);
-  /* Set the streaming pipline to null state to dispose of complete pipeline */
-  gst_element_set_state (data->videoStreamUschl, GST_STATE_NULL);
-  /* Set the waiting pipeline to playing state and update state variable */
-  gst_element_set_state (data->waitingVideoUschl, GST_STATE_PLAYING);
-  g_timeout_add_seconds (10, (GSourceFunc) rtsp_client_Uschl, data);
+  if (!key_file_update_boolean (key_file, "general", "compositor", &compositor, error) ||
+      !key_file_update_boolean (key_file, "general", "standby", &standby, error) ||
+      !key_file_update_boolean (key_file, "general", "server", &server, error) ||
+      !key_file_update_boolean (key_file, "general", "sync", &sync, error) ||
+      !key_file_update_int (key_file, "general", "sync-latency", &latency, error) ||
+      !key_file_update_int (key_file, "general", "no-data-timeout", &timeout, error) ||
+      !key_file_update_int (key_file, "general", "stall-timeout", &stall, error) ||
+      !key_file_update_int (key_file, "general", "placeholder-crop-right", &placeholder_crop_right, error) ||
+      !key_file_update_int (key_file, "general", "placeholder-crop-bottom", &placeholder_crop_bottom, error) ||
+      !key_file_update_int (key_file, "general", "record-segment", &record_segment, error) ||
+      !key_file_update_int (key_file, "general", "record-length", &record_length, error) ||
+      !key_file_update_int (key_file, "general", "record-save", &record_save_length, error))
+    return FALSE;
+  record_segment = MAX (record_segment, 1);
+  record_length = MAX (record_length, record_segment);
+  record_save_length = MAX (record_save_length, 1);
 
+  use_compositor |= compositor;
+  use_standby |= standby;
+  use_server |= server;
+  use_sync |= sync;
+  if (sync_latency < 0)
+    sync_latency = MAX (latency, 0);
+  if (no_data_timeout < 0)
+    no_data_timeout = timeout;
+  if (stall_timeout < 0)
+    stall_timeout = stall;
+  if (!key_file_update_int (key_file, "general", "metrics-port", &port_setting, error))
+    return FALSE;
+  if (metrics_port < 0)
+    metrics_port = port_setting;
+  if (!metrics_socket)
+    key_file_update_string (key_file, "general", "metrics-socket", &metrics_socket);
+  if (!control_socket)
+    key_file_update_string (key_file, "general", "control-socket", &control_socket);
+  if (!ntp_server)
+    key_file_update_string (key_file, "general", "ntp-server", &ntp_server);
+  key_file_update_string (key_file, "general", "mixer", &mixer);
+  if (!mixer_element)
+    mixer_element = mixer;
+  else
+    g_free (mixer);
+  /* The defaults of these are string literals, they are copied so that they can be replaced */
+  placeholder_location = g_strdup (placeholder_location);
+  placeholder_decoder = g_strdup (placeholder_decoder);
+  server_address = g_strdup (server_address);
+  port = g_strdup (port);
+  record_directory = g_strdup (record_directory);
+  key_file_update_string (key_file, "general", "placeholder", &placeholder_location);
+  key_file_update_codec (key_file, "general", "placeholder-decoder", &placeholder_decoder);
+  key_file_update_codec (key_file, "general", "scaler", &scaler_element);
+  key_file_update_string (key_file, "general", "server-address", &server_address);
+  key_file_update_string (key_file, "general", "server-port", &port);
+  key_file_update_string (key_file, "general", "record-directory", &record_directory);
+  return TRUE;
 }
 
-/* This function is called when an End-Of-Stream message is posted on the bus.
- * We just set the pipeline to READY (which stops playback) */
-static void eos_cb_Ulm (GstBus *bus, GstMessage *msg, CustomData *data) {
-  g_print ("End-Of-Stream2 reached.\n");
-  /* Set the streaming pipeline to ready state, wait 1 s to make sure pipeline is ready */
-  gst_element_set_state (data->videoStreamUlm, GST_STATE_READY);
-  /* Set the streaming pipline to null state to dispose of complete pipeline */
-  gst_element_set_state (data->videoStreamUlm, GST_STATE_NULL);
-  /* Set the waiting pipeline to playing state and update state variable */
-  gst_element_set_state (data->waitingVideoUlm, GST_STATE_PLAYING);
-  g_timeout_add_seconds (10, (GSourceFunc) rtsp_client_Ulm, data);
+/* Apply the command line options that override the settings of every stream */
+static void site_apply_options (StreamSite *site) {
+  if (stream_latency >= 0)
+    site->latency = stream_latency;
+  if (stream_decoder) {
+    g_free (site->decoder);
+    site->decoder = g_strcmp0 (stream_decoder, CODEC_AUTO) ? g_strdup (stream_decoder) : NULL;
+  }
+  site->record |= stream_record;
+  site->relay |= stream_relay;
 }
 
-/* This function is called when the pipeline changes states. We use it to
- * keep track of the current state. */
-static void state_changed_cb_Uschl (GstBus *bus, GstMessage *msg, CustomData *data) {
-  GstState old_state, new_state, pending_state;
-  /* Parse received message */
-  gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
-  /* check if we got a message from streaming pipeline */
-  if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data->videoStreamUschl)) {
-    data->stateStreamUschl = new_state;
-    g_print ("Streaming video Uschl state set to %s\n", gst_element_state_get_name (new_state));
+/* Read all [stream NAME] groups of the configuration, with the command line overrides applied.
+ * Returns the sites in the order of the file, NULL on error */
+static GPtrArray *config_load_sites (GKeyFile *key_file, GError **error) {
+  GPtrArray *sites;
+  gchar **groups;
+  guint i;
+
+  sites = g_ptr_array_new_with_free_func ((GDestroyNotify) site_free);
+  groups = g_key_file_get_groups (key_file, NULL);
+  for (i = 0; groups[i]; i++) {
+    StreamSite *site;
+    gint latency, latency_max, delay;
+
+    if (!g_str_has_prefix (groups[i], "stream "))
+      continue;
+    site = site_new (groups[i] + strlen ("stream "));
+    g_ptr_array_add (sites, site);
+    latency = site->latency;
+    latency_max = site->latency_max;
+    delay = site->startup_delay;
+    key_file_update_string (key_file, groups[i], "location", &site->location);
+    key_file_update_string (key_file, groups[i], "user-id", &site->user_id);
+    key_file_update_string (key_file, groups[i], "user-pw", &site->user_pw);
+    key_file_update_codec (key_file, groups[i], "decoder", &site->decoder);
+    if (!key_file_update_int (key_file, groups[i], "latency", &latency, error) ||
+        !key_file_update_boolean (key_file, groups[i], "drop-on-latency", &site->drop_on_latency, error) ||
+        !key_file_update_boolean (key_file, groups[i], "adaptive-latency", &site->adaptive_latency, error) ||
+        !key_file_update_int (key_file, groups[i], "latency-min", &site->latency_min, error) ||
+        !key_file_update_int (key_file, groups[i], "latency-max", &latency_max, error) ||
+        !key_file_update_double (key_file, groups[i], "target-loss", &site->target_loss, error) ||
+        !key_file_update_double (key_file, groups[i], "retransmission-loss", &site->retransmission_loss, error) ||
+        !key_file_update_int (key_file, groups[i], "startup-delay", &delay, error) ||
+        !key_file_update_boolean (key_file, groups[i], "record", &site->record, error) ||
+        !key_file_update_boolean (key_file, groups[i], "relay", &site->relay, error) ||
+        !key_file_update_int (key_file, groups[i], "row", &site->row, error) ||
+        !key_file_update_int (key_file, groups[i], "column", &site->column, error)) {
+      g_prefix_error (error, "[%s]: ", groups[i]);
+      g_strfreev (groups);
+      g_ptr_array_unref (sites);
+      return NULL;
+    }
+    site->latency = MAX (latency, 0);
+    site->latency_max = MAX (latency_max, 0);
+    site->startup_delay = MAX (delay, 0);
   }
-  /* When streaming pipeline is set to PLAYING state we want to immediatly make sure the waiting pipeline is set to PAUSED state */
-  if (new_state == GST_STATE_PLAYING)
-  {
-    /* Set state of waiting pipeline to PAUSED */
-   gst_element_set_state (data->waitingVideoUschl, GST_STATE_PAUSED);
+  g_strfreev (groups);
+
+  /* Command line overrides */
+  for (i = 0; stream_locations && stream_locations[i]; i++) {
+    gchar **pair = g_strsplit (stream_locations[i], "=", 2);
+    StreamSite *site;
+
+    if (!pair[0] || !pair[1]) {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "--stream expects NAME=URL, got %s", stream_locations[i]);
+      g_strfreev (pair);
+      g_ptr_array_unref (sites);
+      return NULL;
+    }
+    site = sites_find (sites, pair[0]);
+    if (!site) {
+      site = site_new (pair[0]);
+      g_ptr_array_add (sites, site);
+    }
+    g_free (site->location);
+    site->location = g_strdup (pair[1]);
+    g_strfreev (pair);
   }
-  /* When streaming pipeline is set to PAUSED/READY/NULL state we want to make sure the waiting pipeline is set to PLAYING state */
-  if (new_state == GST_STATE_PAUSED || new_state == GST_STATE_READY || new_state == GST_STATE_NULL )
-  {
-    /* Set state of waiting pipeline to PLAYING */
-    gst_element_set_state (data->waitingVideoUschl, GST_STATE_PLAYING);
-	}
+  for (i = 0; i < sites->len; i++) {
+    StreamSite *site = g_ptr_array_index (sites, i);
+
+    site_apply_options (site);
+    if (!site->location) {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND, "[stream %s]: no location", site->name);
+      g_ptr_array_unref (sites);
+      return NULL;
+    }
   }
+  return sites;
+}
 
-/* This function is called when the pipeline changes states. We use it to
- * keep track of the current state. */
-static void state_changed_cb_Ulm (GstBus *bus, GstMessage *msg, CustomData *data) {
-  GstState old_state, new_state, pending_state;
-  /* Parse received message */
-  gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
-  /* check if we got a message from streaming pipeline */
-  if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data->videoStreamUlm)) {
-    data->stateStreamUlm = new_state;
-    g_print ("Streaming video Ulm state set to %s\n", gst_element_state_get_name (new_state));
+/* One capture device the rtsp server side serves, a [mount NAME] group of the configuration */
+typedef struct _ServerMount {
+  gchar *name;
+  gchar *path;                    /* Path of the mount in the rtsp url, /NAME if not set */
+  gchar *device;                  /* Capture device */
+  gint width;                     /* Picture captured */
+  gint height;
+  gint framerate;
+  gchar *encoder;                 /* H.264 encoder element, NULL to use the fastest one available */
+  gboolean zero_copy;             /* Hand the captured dmabufs to the encoder instead of copying the frames */
+  gchar **protocols;              /* Lower transports offered to the clients: udp, tcp and/or multicast */
+  gchar *multicast;               /* Multicast address range "FIRST-LAST" to give to the clients that ask for multicast */
+  gint multicast_port_min;        /* Port range of the multicast streams */
+  gint multicast_port_max;
+  gint multicast_ttl;
+} ServerMount;
+
+static void mount_free (ServerMount *mount) {
+  g_free (mount->name);
+  g_free (mount->path);
+  g_free (mount->device);
+  g_free (mount->encoder);
+  g_strfreev (mount->protocols);
+  g_free (mount->multicast);
+  g_free (mount);
+}
+
+/* Read the mount of a [mount NAME] group, which may be missing to get the defaults. NULL on error */
+static ServerMount *mount_load (GKeyFile *key_file, const gchar *group, GError **error) {
+  ServerMount *mount = g_new0 (ServerMount, 1);
+
+  mount->name = g_strdup (group + strlen ("mount "));
+  mount->path = g_strdup_printf ("/%s", mount->name);
+  mount->device = g_strdup ("/dev/video0");
+  mount->width = 1920;
+  mount->height = 1080;
+  mount->framerate = 30;
+  mount->zero_copy = TRUE;
+  mount->multicast_port_min = 5000;
+  mount->multicast_port_max = 5099;
+  mount->multicast_ttl = 16;
+  key_file_update_string (key_file, group, "path", &mount->path);
+  key_file_update_string (key_file, group, "device", &mount->device);
+  key_file_update_codec (key_file, group, "encoder", &mount->encoder);
+  key_file_update_string (key_file, group, "multicast", &mount->multicast);
+  if (g_key_file_has_key (key_file, group, "protocols", NULL))
+    mount->protocols = g_key_file_get_string_list (key_file, group, "protocols", NULL, NULL);
+  if (!key_file_update_int (key_file, group, "width", &mount->width, error) ||
+      !key_file_update_int (key_file, group, "height", &mount->height, error) ||
+      !key_file_update_int (key_file, group, "framerate", &mount->framerate, error) ||
+      !key_file_update_boolean (key_file, group, "zero-copy", &mount->zero_copy, error) ||
+      !key_file_update_int (key_file, group, "multicast-port-min", &mount->multicast_port_min, error) ||
+      !key_file_update_int (key_file, group, "multicast-port-max", &mount->multicast_port_max, error) ||
+      !key_file_update_int (key_file, group, "multicast-ttl", &mount->multicast_ttl, error)) {
+    g_prefix_error (error, "[%s]: ", group);
+    mount_free (mount);
+    return NULL;
   }
-  /* When streaming pipeline is set to PLAYING state we want to immediatly make sure the waiting pipeline is set to PAUSED state */
-  if (new_state == GST_STATE_PLAYING)
-  {
-   /* Set state of waiting pipeline to PAUSED */
-   gst_element_set_state (data->waitingVideoUlm, GST_STATE_PAUSED);
+  return mount;
+}
+
+/* Read all [mount NAME] groups of the configuration. Without any the server serves /dev/video0 at /test,
+ * like it always did. Returns NULL on error */
+static GPtrArray *config_load_mounts (GKeyFile *key_file, GError **error) {
+  GPtrArray *mounts;
+  ServerMount *mount;
+  gchar **groups;
+  guint i;
+
+  mounts = g_ptr_array_new_with_free_func ((GDestroyNotify) mount_free);
+  groups = g_key_file_get_groups (key_file, NULL);
+  for (i = 0; groups[i]; i++) {
+    if (!g_str_has_prefix (groups[i], "mount "))
+      continue;
+    mount = mount_load (key_file, groups[i], error);
+    if (!mount) {
+      g_strfreev (groups);
+      g_ptr_array_unref (mounts);
+      return NULL;
+    }
+    g_ptr_array_add (mounts, mount);
   }
-  /* When streaming pipeline is set to PAUSED/READY/NULL state we want to make sure the waiting pipeline is set to PLAYING state */
-  if (new_state == GST_STATE_PAUSED || new_state == GST_STATE_READY || new_state == GST_STATE_NULL)
-  {
-   /* Set state of waiting pipeline to PLAYING */
-   gst_element_set_state (data->waitingVideoUlm, GST_STATE_PLAYING);
+  g_strfreev (groups);
+  if (mounts->len == 0)
+    g_ptr_array_add (mounts, mount_load (key_file, "mount test", NULL));
+  return mounts;
+}
+
+/* Load the configuration file, or the built-in default_config if there is none */
+static GKeyFile *config_open (GError **error) {
+  GKeyFile *key_file = g_key_file_new ();
+  gboolean ok;
+
+  if (config_file)
+    ok = g_key_file_load_from_file (key_file, config_file, G_KEY_FILE_NONE, error);
+  else
+    ok = g_key_file_load_from_data (key_file, default_config, -1, G_KEY_FILE_NONE, error);
+  if (!ok) {
+    g_key_file_free (key_file);
+    return NULL;
   }
+  return key_file;
 }
 
-/* This function is called when an error message is posted on the bus */
-static void error_cb_Uschl (GstBus *bus, GstMessage *msg, CustomData *data) {
-  GError *err;
-  gchar *debug_info;
-  GstStateChangeReturn ret;
-  char *err_msg;
-  GError *error=NULL;
+/* One H.264 codec element the probe can choose from */
+typedef struct _CodecElement {
+  const gchar *name;              /* Element factory */
+  const gchar *desc;              /* Launch line fragment creating it, with its settings */
+  const gchar *dmabuf;            /* Settings importing dmabufs from the element upstream without a copy, NULL if it cannot */
+  gdouble fps;                    /* Frames per second measured by the probe, -1 if it could not measure */
+} CodecElement;
 
-  /* Set the pipeline to READY (which stops playback) */
-  gst_element_set_state (data->videoStreamUschl, GST_STATE_READY);
-  gst_element_set_state (data->videoStreamUschl, GST_STATE_NULL);
-  /* Set pipeline 2 to playing state */
-	gst_element_set_state (data->waitingVideoUschl, GST_STATE_PLAYING);
-  g_timeout_add_seconds (10, (GSourceFunc) rtsp_client_Uschl, data);
+/* Decoders and encoders in order of preference, hardware first. The order decides between codecs
+ * the probe could not measure or measured equally fast */
+static CodecElement decoder_table[] = {
+  { "v4l2h264dec", "v4l2h264dec", NULL, 0 },
+  { "omxh264dec", "omxh264dec", NULL, 0 },
+  { "vaapih264dec", "vaapih264dec", NULL, 0 },
+  { "avdec_h264", "avdec_h264 max-threads=0", NULL, 0 },
+};
+static CodecElement encoder_table[] = {
+  { "v4l2h264enc", "v4l2h264enc", "output-io-mode=dmabuf-import", 0 },
+  { "omxh264enc", "omxh264enc", NULL, 0 },
+  { "vaapih264enc", "vaapih264enc", NULL, 0 },
+  { "x264enc", "x264enc tune=zerolatency speed-preset=ultrafast", NULL, 0 },
+};
 
-  /* Print error details on the screen */
-  gst_message_parse_error (msg, &err, &debug_info);
-  err_msg=err->message;
-  g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
-  g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
-  
-  g_clear_error (&err);
-  g_free (debug_info);
+/* The codecs that work on this machine, fastest first. Encoders are only probed when the server needs one */
+static GPtrArray *decoders = NULL;
+static GPtrArray *encoders = NULL;
+
+/* Buffer probe counting the frames a codec produced */
+static GstPadProbeReturn codec_count_cb (GstPad *pad, GstPadProbeInfo *info, gint *frames) {
+  g_atomic_int_inc (frames);
+  return GST_PAD_PROBE_OK;
 }
 
+/* Run pipe_desc, which ends in a fakesink named sink, until it is done or for CODEC_PROBE_TIME.
+ * Returns the frames per second that reached the sink, 0 if the pipeline failed */
+static gdouble codec_measure (const gchar *pipe_desc) {
+  GstElement *pipeline, *sink;
+  GError *error = NULL;
+  GstMessage *msg;
+  GstBus *bus;
+  GstPad *pad;
+  gint frames = 0;
+  gint64 start, elapsed;
+  gdouble fps = 0;
 
-/*Same for second pipeline */
-static void error_cb_Ulm (GstBus *bus, GstMessage *msg, CustomData *data) {
-  GError *err;
-  gchar *debug_info;
-  GstStateChangeReturn ret;
-  char *err_msg;
-  GError *error=NULL;
+  pipeline = gst_parse_launch (pipe_desc, &error);
+  if (!pipeline || error) {
+    g_clear_error (&error);
+    if (pipeline)
+      gst_object_unref (pipeline);
+    return 0;
+  }
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) codec_count_cb, &frames, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (sink);
 
-  /* Set the pipeline to READY (which stops playback) */
-  gst_element_set_state (data->videoStreamUlm, GST_STATE_READY);
-  gst_element_set_state (data->videoStreamUlm, GST_STATE_NULL);
-  /* Set pipeline 2 to playing state */
-  gst_element_set_state (data->waitingVideoUlm, GST_STATE_PLAYING);
-  g_timeout_add_seconds (10, (GSourceFunc) rtsp_client_Ulm, data);
+  bus = gst_element_get_bus (pipeline);
+  start = g_get_monotonic_time ();
+  if (gst_element_set_state (pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE) {
+    msg = gst_bus_timed_pop_filtered (bus, CODEC_PROBE_TIME * GST_MSECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    elapsed = g_get_monotonic_time () - start;
+    if (!msg || GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS)
+      fps = (gdouble) g_atomic_int_get (&frames) * G_USEC_PER_SEC / MAX (elapsed, 1);
+    if (msg)
+      gst_message_unref (msg);
+  }
+  /* Setting NULL waits for the streaming threads, the probe cannot count anymore afterwards */
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+  return fps;
+}
 
-  /* Print error details on the screen */
-  gst_message_parse_error (msg, &err, &debug_info);
-  err_msg=err->message;
-  g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
-  g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
-  g_clear_error (&err);
-  g_free (debug_info);
+/* Sort the fastest codec first, ties keep the order of their table */
+static gint codec_compare (gconstpointer a, gconstpointer b) {
+  const CodecElement *ca = *(const CodecElement **) a;
+  const CodecElement *cb = *(const CodecElement **) b;
+
+  if (ca->fps != cb->fps)
+    return ca->fps > cb->fps ? -1 : 1;
+  return ca < cb ? -1 : ca > cb;
 }
 
-/* restart thread for first video stream */
-static gboolean rtsp_client_Uschl (CustomData *data)
-{
-  GError *error=NULL;
-  GstStateChangeReturn ret;
-  gchar *pipe_desc;
+/* Find the codecs of table that are installed and work, and rank them by speed. Each is measured between upstream and
+ * a fakesink, without an upstream only their presence is checked */
+static GPtrArray *codec_rank (CodecElement *table, guint count, const gchar *upstream) {
+  GPtrArray *ranked = g_ptr_array_new ();
+  guint i;
 
-  /* Create the elements */
-  pipe_desc= g_strdup_printf ("rtspsrc location=rtsp://10.252.61.91:8554/test latency=0 do-retransmission=false user-id=user user-pw=password ! rtpjitterbuffer latency=10 drop-on-latency=true mode=2 ! application/x-rtp, encoding-name=H264 ! rtph264depay ! h264parse ! capsfilter caps='video/x-h264, stream-format=byte-stream, frame-rate=30/1' ! omxh264dec ! glimagesink sync=false async=false"); 
-//  pipe_desc= g_strdup_printf ("rtspsrc location=rtsp://169.254.197.5:8554/test latency=0 do-retransmission=false user-id=user user-pw=password ! queue name=q ! rtpjitterbuffer latency=10 drop-on-latency=true mode=2 ! application/x-rtp, encoding-name=H264 ! rtph264depay ! h264parse ! capsfilter caps='video/x-h264, stream-format=byte-stream, frame-rate=30/1' ! omxh264dec ! glimagesink sync=false async=false"); 
-  data->videoStreamUschl=gst_parse_launch(pipe_desc, &error);
-  g_free(pipe_desc);
+  for (i = 0; i < count; i++) {
+    CodecElement *codec = &table[i];
+    GstElementFactory *factory = gst_element_factory_find (codec->name);
+    gchar *pipe_desc;
 
-  /* Instruct the busStreamUschl to emit signals for each received message, and connect to the interesting signals */
-  data->busStreamUschl = gst_element_get_bus (data->videoStreamUschl);
-  gst_bus_set_sync_handler (data->busStreamUschl, (GstBusSyncHandler) bus_sync_handler_Uschl, NULL, NULL);
-  gst_bus_add_signal_watch (data->busStreamUschl);
-  g_signal_connect (G_OBJECT (data->busStreamUschl), "message::error", (GCallback)error_cb_Uschl, data);
-  g_signal_connect (G_OBJECT (data->busStreamUschl), "message::eos", (GCallback)eos_cb_Uschl, data);
-  g_signal_connect (G_OBJECT (data->busStreamUschl), "message::state-changed", (GCallback)state_changed_cb_Uschl, data);
-  gst_object_unref (data->busStreamUschl);
+    if (!factory)
+      continue;
+    gst_object_unref (factory);
 
-  /* Start playing */
-  ret=gst_element_set_state (data->videoStreamUschl, GST_STATE_PLAYING);
-  if (ret==GST_STATE_CHANGE_FAILURE) {
-    g_printerr ("Unable to set the pipeline to the playing state.\n");
-    data->videoStreamUschl=NULL;
-    return TRUE;
+    codec->fps = -1;
+    if (upstream) {
+      pipe_desc = g_strdup_printf ("%s ! %s ! fakesink name=sink sync=false", upstream, codec->desc);
+      codec->fps = codec_measure (pipe_desc);
+      g_free (pipe_desc);
+      if (codec->fps <= 0) {
+        g_print ("%s is installed but does not work here\n", codec->name);
+        continue;
+      }
+    }
+    g_ptr_array_add (ranked, codec);
   }
-  /* return FALSE to make sure function is only called once */
-  return FALSE;
+  g_ptr_array_sort (ranked, codec_compare);
+
+  for (i = 0; i < ranked->len; i++) {
+    CodecElement *codec = g_ptr_array_index (ranked, i);
+
+    if (codec->fps > 0)
+      g_print ("%u. %s (%.0f fps)\n", i + 1, codec->name, codec->fps);
+    else
+      g_print ("%u. %s (not measured)\n", i + 1, codec->name);
+  }
+  return ranked;
 }
 
-/* restart thread for second video stream */
-static gboolean rtsp_client_Ulm (CustomData *data)
-{
-  GError *error=NULL;
-  GstStateChangeReturn ret;
-  gchar *pipe_desc;
+/* File the ranking of the decoders is kept in between runs, so that only the first start of a node measures them */
+static gchar *decoders_cache_path (void) {
+  return g_build_filename (g_get_user_cache_dir (), "virtualwindow", "decoders", NULL);
+}
 
-  /* Create the elements */
-  pipe_desc= g_strdup_printf ("rtspsrc location=rtsp://10.252.61.135:8554/test latency=0 do-retransmission=false user-id=user user-pw=password ! rtpjitterbuffer latency=10 drop-on-latency=true mode=2 ! application/x-rtp, encoding-name=H264 ! rtph264depay ! h264parse ! capsfilter caps='video/x-h264, stream-format=byte-stream, frame-rate=30/1' ! omxh264dec ! glimagesink sync=false async=false"); 
-//  pipe_desc= g_strdup_printf ("rtspsrc location=rtsp://169.254.197.5:8554/test latency=0 do-retransmission=false user-id=admin user-pw=power ! queue name=q ! rtpjitterbuffer latency=10 drop-on-latency=true mode=2 ! application/x-rtp, encoding-name=H264 ! rtph264depay ! h264parse ! capsfilter caps='video/x-h264, stream-format=byte-stream, frame-rate=30/1' ! omxh264dec ! glimagesink sync=false async=false"); 
-  data->videoStreamUlm=gst_parse_launch(pipe_desc, &error);
-  g_free(pipe_desc);
+/* The decoders of decoder_table that are installed, separated by ;. The cached ranking is only valid for these */
+static gchar *decoders_installed (void) {
+  GString *installed = g_string_new (NULL);
+  guint i;
 
-  /* Instruct the busStreamUlm to emit signals for each received message, and connect to the interesting signals */
-  data->busStreamUlm = gst_element_get_bus (data->videoStreamUlm);
-  gst_bus_set_sync_handler (data->busStreamUlm, (GstBusSyncHandler) bus_sync_handler_Ulm, NULL, NULL);
-  gst_bus_add_signal_watch (data->busStreamUlm);
-  g_signal_connect (G_OBJECT (data->busStreamUlm), "message::error", (GCallback)error_cb_Ulm, data);
-  g_signal_connect (G_OBJECT (data->busStreamUlm), "message::eos", (GCallback)eos_cb_Ulm, data);
-  g_signal_connect (G_OBJECT (data->busStreamUlm), "message::state-changed", (GCallback)state_changed_cb_Ulm, data);
-  gst_object_unref (data->busStreamUlm);
+  for (i = 0; i < G_N_ELEMENTS (decoder_table); i++) {
+    GstElementFactory *factory = gst_element_factory_find (decoder_table[i].name);
 
-  /* Start playing */
-  ret=gst_element_set_state (data->videoStreamUlm, GST_STATE_PLAYING);
-  if (ret==GST_STATE_CHANGE_FAILURE) {
-    g_printerr ("Unable to set the pipeline to the playing state.\n");
-    data->videoStreamUlm=NULL;
-    return TRUE;
+    if (!factory)
+      continue;
+    gst_object_unref (factory);
+    g_string_append_printf (installed, "%s;", decoder_table[i].name);
   }
-  /* return FALSE to make sure function is only called once */
-  return FALSE;
+  return g_string_free (installed, FALSE);
 }
 
-/* This thread handles the startup and running of the rtsp server side */
-gboolean rtsp_server(void)
-{
-  GMainLoop *loop;
-  GstRTSPServer *server;
-  GstRTSPMountPoints *mounts;
-  GstRTSPMediaFactory *factory;
+/* The ranking of the last probe, NULL if there is none or GStreamer or the installed decoders changed since */
+static GPtrArray *decoders_cache_load (void) {
+  GKeyFile *key_file = g_key_file_new ();
+  gchar *path = decoders_cache_path ();
+  gchar *installed = decoders_installed ();
+  gchar *version = gst_version_string ();
+  gchar *cached_version = NULL, *cached_installed = NULL;
+  gchar **names = NULL;
+  gdouble *fps = NULL;
+  gsize count = 0, fps_count = 0;
+  GPtrArray *ranked = NULL;
+  guint i, j;
 
-  /* create main loop */
-  loop = g_main_loop_new (NULL, FALSE);
+  if (g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, NULL)) {
+    cached_version = g_key_file_get_string (key_file, "decoders", "gstreamer", NULL);
+    cached_installed = g_key_file_get_string (key_file, "decoders", "installed", NULL);
+    names = g_key_file_get_string_list (key_file, "decoders", "ranking", &count, NULL);
+    fps = g_key_file_get_double_list (key_file, "decoders", "fps", &fps_count, NULL);
+  }
+  if (names && count && fps_count == count && g_strcmp0 (cached_version, version) == 0 &&
+      g_strcmp0 (cached_installed, installed) == 0) {
+    ranked = g_ptr_array_new ();
+    for (i = 0; i < count; i++) {
+      for (j = 0; j < G_N_ELEMENTS (decoder_table); j++) {
+        if (g_strcmp0 (names[i], decoder_table[j].name) == 0) {
+          decoder_table[j].fps = fps[i];
+          g_ptr_array_add (ranked, &decoder_table[j]);
+        }
+      }
+    }
+    if (ranked->len == 0)
+      g_clear_pointer (&ranked, g_ptr_array_unref);
+  }
+  if (ranked) {
+    g_print ("H.264 decoders as ranked by the last probe, delete %s to probe them again\n", path);
+    for (i = 0; i < ranked->len; i++) {
+      CodecElement *codec = g_ptr_array_index (ranked, i);
 
-  /* create a server instance */
-  server = gst_rtsp_server_new ();
-  gst_rtsp_server_set_address(server, "10.252.61.91");
-  g_object_set (server, "service", port, NULL);
+      g_print ("%u. %s (%.0f fps)\n", i + 1, codec->name, codec->fps);
+    }
+  }
+  g_strfreev (names);
+  g_free (fps);
+  g_free (cached_version);
+  g_free (cached_installed);
+  g_free (version);
+  g_free (installed);
+  g_free (path);
+  g_key_file_free (key_file);
+  return ranked;
+}
 
-  /* get the mount points for this server, every server has a default object
-   * that be used to map uri mount points to media factories */
-  mounts = gst_rtsp_server_get_mount_points (server);
+/* Keep the measured ranking of the decoders for the next start */
+static void decoders_cache_save (void) {
+  GKeyFile *key_file = g_key_file_new ();
+  gchar *path = decoders_cache_path ();
+  gchar *directory = g_path_get_dirname (path);
+  gchar *installed = decoders_installed ();
+  gchar *version = gst_version_string ();
+  const gchar **names = g_new0 (const gchar *, decoders->len + 1);
+  gdouble *fps = g_new (gdouble, decoders->len);
+  GError *error = NULL;
+  guint i;
 
-  /* make a media factory for a test stream. The default media factory can use
-   * gst-launch syntax to create pipelines.
-   * any launch line works as long as it contains elements named pay%d. Each
-   * element with pay%d names will be a stream */
-  factory = gst_rtsp_media_factory_new ();
-  gst_rtsp_media_factory_set_launch (factory, "v4l2src ! video/x-raw, width=1920, height=1080, framerate=30/1 ! queue max-size-buffers=1 leaky=downstream ! omxh264enc ! video/x-h264, stream-format=byte-stream, alignment=au, profile=high ! h264parse ! rtph264pay name=pay0 pt=96 ");
+  for (i = 0; i < decoders->len; i++) {
+    CodecElement *codec = g_ptr_array_index (decoders, i);
 
-  /* make rtsp-server available for multiple clients */
-  gst_rtsp_media_factory_set_shared(factory, TRUE);
+    names[i] = codec->name;
+    fps[i] = codec->fps;
+  }
+  g_key_file_set_string (key_file, "decoders", "gstreamer", version);
+  g_key_file_set_string (key_file, "decoders", "installed", installed);
+  g_key_file_set_string_list (key_file, "decoders", "ranking", names, decoders->len);
+  g_key_file_set_double_list (key_file, "decoders", "fps", fps, decoders->len);
+  if (g_mkdir_with_parents (directory, 0755) != 0 || !g_key_file_save_to_file (key_file, path, &error)) {
+    g_printerr ("Unable to keep the decoder ranking in %s, the next start probes again: %s\n", path,
+        error ? error->message : g_strerror (errno));
+    g_clear_error (&error);
+  }
+  g_free (names);
+  g_free (fps);
+  g_free (version);
+  g_free (installed);
+  g_free (directory);
+  g_free (path);
+  g_key_file_free (key_file);
+}
 
-  /* attach the test factory to the /test url */
-  gst_rtsp_mount_points_add_factory (mounts, "/test", factory);
+/* Rank the decoders on the waiting video, the one H.264 clip every node has. Measuring takes up to CODEC_PROBE_TIME
+ * per decoder and would hold up the first connects, so the ranking is measured on the first start only and taken from
+ * the cache after that. A decoder that stopped working is still replaced by the next one, see stream_decoder_fallback */
+static gboolean decoders_probe (void) {
+  gchar *upstream = NULL;
+  gboolean upstream_measured;
 
-  /* don't need the ref to the mapper anymore */
-  g_object_unref (mounts);
+  decoders = decoders_cache_load ();
+  if (decoders)
+    return TRUE;
 
-  /* attach the server to the default maincontext */
-  gst_rtsp_server_attach (server, NULL);
+  if (g_file_test (placeholder_location, G_FILE_TEST_IS_REGULAR))
+    upstream = g_strdup_printf ("filesrc location=\"%s\" ! h264parse", placeholder_location);
+  else
+    g_printerr ("Waiting video %s not found, decoders are ranked without measuring them\n", placeholder_location);
+  g_print ("Probing H.264 decoders\n");
+  decoders = codec_rank (decoder_table, G_N_ELEMENTS (decoder_table), upstream);
+  upstream_measured = upstream != NULL;
+  g_free (upstream);
+  if (decoders->len == 0) {
+    g_printerr ("No working H.264 decoder found\n");
+    return FALSE;
+  }
+  if (upstream_measured)
+    decoders_cache_save ();
+  return TRUE;
+}
 
-  /* start serving */
-  g_print ("stream ready at rtsp://10.252.61.91:%s/test\n", port);
-  
-  /* return FALSE to make sure function is only called once */
-  return FALSE;
+/* Rank the encoders on a test picture of the size the server sends */
+static gboolean encoders_probe (void) {
+  gchar *upstream;
+
+  upstream = g_strdup_printf ("videotestsrc num-buffers=%d ! video/x-raw, width=1920, height=1080, framerate=30/1 ! videoconvert", CODEC_PROBE_FRAMES);
+  g_print ("Probing H.264 encoders\n");
+  encoders = codec_rank (encoder_table, G_N_ELEMENTS (encoder_table), upstream);
+  g_free (upstream);
+  if (encoders->len == 0) {
+    g_printerr ("No working H.264 encoder found\n");
+    return FALSE;
+  }
+  return TRUE;
 }
 
-int main(int argc, char *argv[]) {
-  CustomData data;
-  GstStateChangeReturn ret;
-  gchar *pipe_desc_Uschl;
-  gchar *pipe_desc_Ulm;
-  gchar *pipe_desc1;
-  gchar *pipe_desc2;
-  GError *error=NULL;
-  GstMessage *msg;
+/* Launch line fragment of the decoder the next pipeline of the stream uses */
+static const gchar *stream_decoder_desc (VideoStream *stream) {
+  CodecElement *codec;
 
-  /* Initialize GTK */
-  gtk_init (&argc, &argv);
+  if (stream->decoder_rank < 0)
+    return stream->site->decoder;
+  codec = g_ptr_array_index (decoders, MIN ((guint) stream->decoder_rank, decoders->len - 1));
+  return codec->desc;
+}
 
-  /* Initialize GStreamer */
-  gst_init (&argc, &argv);
+/* Choose the element scaling decoded frames to the size of their tiles. v4l2convert does it in the ISP on the dmabufs of
+ * the hardware decoder. Without a hardware scaler the frames are not scaled before the sink, which scales them on the GPU,
+ * as scaling them on the CPU would cost more than the copies it saves */
+static void scaler_choose (void) {
+  GstElementFactory *factory;
 
-  /* Initialize our data structure */
-  memset (&data, 0, sizeof (data));
-  data.duration = GST_CLOCK_TIME_NONE;
+  if (g_strcmp0 (scaler_element, SCALER_NONE) == 0) {
+    g_free (scaler_element);
+    scaler_element = NULL;
+  } else if (!scaler_element && (factory = gst_element_factory_find ("v4l2convert"))) {
+    scaler_element = g_strdup ("v4l2convert");
+    gst_object_unref (factory);
+  }
+  g_print ("Decoded frames are scaled to their tiles by %s\n", scaler_element ? scaler_element : "the video sinks");
+}
 
- /* First snow pipeline (waitingVideoUschl) */
-  pipe_desc_Uschl= g_strdup_printf ("multifilesrc location=/home/pi/test.h264 loop=true ! h264parse ! omxh264dec ! videocrop right=275 bottom=75 ! glimagesink sync=false async=false");
-//  pipe_desc2= g_strdup_printf ("videotestsrc pattern=1 ! glimagesink ");
-  data.waitingVideoUschl=gst_parse_launch(pipe_desc_Uschl, &error);
-  g_free(pipe_desc_Uschl);
-  error=NULL;
+/* Launch line fragment scaling decoded frames to the size set with pipeline_set_size, free with g_free */
+static gchar *scaler_desc (void) {
+  if (!scaler_element)
+    return g_strdup ("");
+  return g_strdup_printf ("%s name=scale ! capsfilter name=size ! ", scaler_element);
+}
 
-  /* First snow pipeline (waitingVideoUschl) */
-//  pipe_desc4= g_strdup_printf ("videotestsrc pattern=1 ! glimagesink ");
-  pipe_desc_Ulm= g_strdup_printf ("multifilesrc location=/home/pi/test.h264 loop=true ! h264parse ! omxh264dec ! videocrop right=275 bottom=75 ! glimagesink sync=false async=false");
-  data.waitingVideoUlm=gst_parse_launch(pipe_desc_Ulm, &error);
-  g_free(pipe_desc_Ulm);
+/* Make the scaler of pipeline fit its frames into width x height, keeping their aspect ratio. Frames that fit already
+ * are left alone, 0 leaves all frames alone. New caps on a playing pipeline renegotiate the scaler at the next frame */
+static void pipeline_set_size (GstElement *pipeline, gint width, gint height) {
+  GstElement *size = gst_bin_get_by_name (GST_BIN (pipeline), "size");
+  GstCaps *caps;
+  gchar *str;
 
-  /* Create the GUI */
-  create_ui (&data);
+  if (!size)
+    return;
+  if (width > 0 && height > 0)
+    str = g_strdup_printf ("video/x-raw, width=(int)[1, %d], height=(int)[1, %d], pixel-aspect-ratio=(fraction)1/1", width, height);
+  else
+    str = g_strdup ("video/x-raw");
+  caps = gst_caps_from_string (str);
+  g_object_set (size, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_free (str);
+  gst_object_unref (size);
+}
 
-  /* Instruct the busWaitingUschl to emit signals for each received message, and connect to the interesting signals */
-  data.busWaitingUschl = gst_element_get_bus (data.waitingVideoUschl);
-  gst_bus_set_sync_handler (data.busWaitingUschl, (GstBusSyncHandler) bus_sync_handler_Uschl, NULL, NULL);
+/* The decoder of the stream failed: move on to the next decoder of the ranking that is a different element.
+ * Returns FALSE if there is none left, the stream then keeps trying the last one */
+static gboolean stream_decoder_fallback (VideoStream *stream, const gchar *failed) {
+  gint rank;
 
-  gst_object_unref (data.busWaitingUschl);
+  for (rank = stream->decoder_rank + 1; rank < (gint) decoders->len; rank++) {
+    CodecElement *codec = g_ptr_array_index (decoders, rank);
 
-  /* Start playing */
-  ret=gst_element_set_state (data.waitingVideoUschl, GST_STATE_PLAYING);
-  if (ret==GST_STATE_CHANGE_FAILURE) {
-    g_printerr ("Unable to set the pipeline to the playing state.\n");
-    gst_object_unref (data.waitingVideoUschl);
-    return -1;
+    if (g_strcmp0 (codec->name, failed) != 0) {
+      g_printerr ("Decoder %s of stream %s failed, falling back to %s\n", failed, stream->site->name, codec->name);
+      stream->decoder_rank = rank;
+      return TRUE;
+    }
   }
+  g_printerr ("Decoder %s of stream %s failed and there is no other decoder left\n", failed, stream->site->name);
+  return FALSE;
+}
 
-  /* Instruct the busStreamUlm to emit signals for each received message, and connect to the interesting signals */
-  data.busWaitingUlm = gst_element_get_bus (data.waitingVideoUlm);
-  gst_bus_set_sync_handler (data.busWaitingUlm, (GstBusSyncHandler) bus_sync_handler_Ulm, NULL, NULL);
+/* Definition of function to start a video stream */
+static gboolean rtsp_client (VideoStream *stream);
 
-  gst_object_unref (data.busWaitingUlm);
+/* Run func (data) on the control thread of the stream after interval milliseconds.
+ * The caller owns a reference to the returned source */
+static GSource *stream_timeout_add (VideoStream *stream, guint interval, GSourceFunc func, gpointer data) {
+  GSource *source = g_timeout_source_new (interval);
 
-  /* Start playing */
-  ret=gst_element_set_state (data.waitingVideoUlm, GST_STATE_PLAYING);
-  if (ret==GST_STATE_CHANGE_FAILURE) {
-    g_printerr ("Unable to set second pipeline to the playing state.\n");
-    gst_object_unref (data.waitingVideoUlm);
-    return -1;
+  g_source_set_callback (source, func, data, NULL);
+  g_source_attach (source, stream->context);
+  return source;
+}
+
+/* Run func (data) on the control thread of the stream as soon as possible, notify frees data afterwards */
+static void stream_invoke (VideoStream *stream, GSourceFunc func, gpointer data, GDestroyNotify notify) {
+  g_main_context_invoke_full (stream->context, G_PRIORITY_DEFAULT, func, data, notify);
+}
+
+/* Scale the frames of the live stream pipelines to the size the tile is drawn at now. Control thread only */
+static gboolean stream_resize_cb (VideoStream *stream) {
+  gint width = g_atomic_int_get (&stream->tileWidth);
+  gint height = g_atomic_int_get (&stream->tileHeight);
+
+  if (stream->videoStream)
+    pipeline_set_size (stream->videoStream, width, height);
+  if (stream->standbyStream)
+    pipeline_set_size (stream->standbyStream, width, height);
+  return G_SOURCE_REMOVE;
+}
+
+/* Drop the pending (re)connect of the stream, if there is one */
+static void stream_cancel_reconnect (VideoStream *stream) {
+  if (!stream->reconnectSource)
+    return;
+  g_source_destroy (stream->reconnectSource);
+  g_source_unref (stream->reconnectSource);
+  stream->reconnectSource = NULL;
+}
+
+/* This function is called when the glimagesink element posts a prepare-window-handle message
+ * -> bus sync handler will be called from the streaming thread directly
+ * in this function we tell glimagesink to render on existing application window (window_handle)
+ * needed because glimagesink element itself is created asynchronously from a GStreamer streaming thread some time after the pipeline has been started up */
+static GstBusSyncReply bus_sync_handler (GstBus * bus, GstMessage * message, guintptr *window_handle){
+  GstVideoOverlay *overlay;
+  /* ignore anything but 'prepare-window-handle' element messages */
+  if (!gst_is_video_overlay_prepare_window_handle_message (message)){
+    return GST_BUS_PASS;
+  }
+  if (*window_handle != 0) {
+    /* GST_MESSAGE_SRC (message) will be the video sink element */
+    overlay = GST_VIDEO_OVERLAY (GST_MESSAGE_SRC (message));
+    gst_video_overlay_set_window_handle (overlay, *window_handle);
+  } else {
+    g_warning ("Should have obtained window_handle by now!");
   }
+  gst_message_unref (message);
+  return GST_BUS_DROP;
+}
 
-  /* Register a function that GLib will call once after 10 seconds */
-  g_timeout_add_seconds (10, (GSourceFunc) rtsp_client_Uschl, &data);
-  /* Register a function that GLib will call once after 5 seconds */
-  g_timeout_add_seconds (5, (GSourceFunc) rtsp_client_Ulm, &data);
-  /* Register a function that GLib will call once after 1 second */
-  //g_timeout_add_seconds (1, (GSourceFunc) rtsp_server, NULL);
-  
-  /* Start the GTK main loop. We will not regain control until gtk_main_quit is called. */
-  gtk_main ();
+/* This function is called when the GUI toolkit creates the physical window that will hold the video.
+ * At this point we can retrieve its handler (which has a different meaning depending on the windowing system)
+ * and pass it to GStreamer through the VideoOverlay interface. */
+static guintptr widget_get_window_handle (GtkWidget *widget) {
+  GdkWindow *window = gtk_widget_get_window (widget);
+  guintptr window_handle = 0;
+
+  if (!gdk_window_ensure_native (window))
+    g_error ("Couldn't create native window needed for GstVideoOverlay!");
 
-  /* Free resources */
-  gst_element_set_state (data.videoStreamUschl, GST_STATE_NULL);
-  gst_object_unref (data.videoStreamUschl);
-  gst_element_set_state (data.waitingVideoUschl, GST_STATE_NULL);
-  gst_object_unref (data.waitingVideoUschl);
-  gst_element_set_state (data.videoStreamUlm, GST_STATE_NULL);
-  gst_object_unref (data.videoStreamUlm);
-  gst_element_set_state (data.waitingVideoUlm, GST_STATE_NULL);
-  gst_object_unref (data.waitingVideoUlm);
+  /* Retrieve window handler from GDK */
+#if defined (GDK_WINDOWING_WIN32)
+  window_handle = (guintptr)GDK_WINDOW_HWND (window);
+#elif defined (GDK_WINDOWING_QUARTZ)
+  window_handle = gdk_quartz_window_get_nsview (window);
+#elif defined (GDK_WINDOWING_X11)
+  window_handle = GDK_WINDOW_XID (window);
+#endif
+  return window_handle;
+}
+
+/* Realize callback of a tile: remember the window handle of the tile for its display pipeline */
+static void realize_cb (GtkWidget *widget, VideoStream *stream) {
+  stream->window_handle = widget_get_window_handle (widget);
+
+  /* Pass it to the pipeline, which implements VideoOverlay and will forward it to the video sink */
+  gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (stream->display), stream->window_handle);
+}
+
+/* Realize callback of the single video window in compositor mode. The compositor pipeline is started
+ * after the UI has been realized, its glimagesink picks the handle up in bus_sync_handler */
+static void wall_realize_cb (GtkWidget *widget, CustomData *data) {
+  data->window_handle = widget_get_window_handle (widget);
+}
+
+/* Start or stop decoding the live stream of a tile that became visible or hidden */
+static void stream_set_hidden (VideoStream *stream, gboolean hidden) {
+  if (hidden == (g_atomic_int_get (&stream->decoding) == DECODE_NONE))
+    return;
+  if (hidden) {
+    g_print ("Tile of stream %s is hidden, decoding stops\n", stream->site->name);
+    g_atomic_int_set (&stream->decoding, DECODE_NONE);
+    return;
+  }
+  g_print ("Tile of stream %s is visible, decoding resumes at the next keyframe\n", stream->site->name);
+  /* The live frames stopped while hidden, the keyframe gets the time of a timeout before the waiting video is shown */
+  g_mutex_lock (&stream->liveLock);
+  stream->lastLiveFrame = g_get_monotonic_time ();
+  g_mutex_unlock (&stream->liveLock);
+  g_atomic_int_set (&stream->decoding, DECODE_RESUME);
+}
+
+static void tiles_update_visibility (CustomData *data) {
+  guint i;
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    stream_set_hidden (stream, data->iconified || stream->tileHidden);
+  }
+}
+
+/* TRUE if a map, unmap or visibility event leaves its drawing area hidden, *hidden is not touched for other events */
+static gboolean event_get_hidden (GdkEvent *event, gboolean *hidden) {
+  switch (event->type) {
+    case GDK_MAP:
+      *hidden = FALSE;
+      return TRUE;
+    case GDK_UNMAP:
+      *hidden = TRUE;
+      return TRUE;
+    case GDK_VISIBILITY_NOTIFY:
+      *hidden = event->visibility.state == GDK_VISIBILITY_FULLY_OBSCURED;
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+/* Map, unmap and visibility events of a tile (window mode only) */
+static gboolean tile_event_cb (GtkWidget *widget, GdkEvent *event, VideoStream *stream) {
+  if (event_get_hidden (event, &stream->tileHidden))
+    tiles_update_visibility (stream->app);
+  return FALSE;
+}
+
+/* Map, unmap and visibility events of the single video window, they apply to all tiles (compositor mode only) */
+static gboolean wall_event_cb (GtkWidget *widget, GdkEvent *event, CustomData *data) {
+  gboolean hidden;
+  guint i;
+
+  if (!event_get_hidden (event, &hidden))
+    return FALSE;
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    stream->tileHidden = hidden;
+  }
+  tiles_update_visibility (data);
+  return FALSE;
+}
+
+/* The tile of the stream is drawn at width x height pixels from now on */
+static void stream_set_size (VideoStream *stream, gint width, gint height) {
+  if (g_atomic_int_get (&stream->tileWidth) == width && g_atomic_int_get (&stream->tileHeight) == height)
+    return;
+  g_atomic_int_set (&stream->tileWidth, width);
+  g_atomic_int_set (&stream->tileHeight, height);
+  stream_invoke (stream, (GSourceFunc) stream_resize_cb, stream, NULL);
+}
+
+/* The waiting video is decoded once for all tiles, it is scaled to fit the largest of them */
+static void placeholder_resize (CustomData *data) {
+  gint width = 0, height = 0;
+  guint i;
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    width = MAX (width, stream->tileWidth);
+    height = MAX (height, stream->tileHeight);
+  }
+  pipeline_set_size (data->placeholder, width, height);
+}
+
+/* A tile got its size, in device pixels (window mode only) */
+static void tile_size_allocate_cb (GtkWidget *widget, GtkAllocation *allocation, VideoStream *stream) {
+  gint scale = gtk_widget_get_scale_factor (widget);
+
+  stream_set_size (stream, allocation->width * scale, allocation->height * scale);
+  placeholder_resize (stream->app);
+}
+
+/* The single video window got its size, every tile gets its cell of the grid (compositor mode only) */
+static void wall_size_allocate_cb (GtkWidget *widget, GtkAllocation *allocation, CustomData *data) {
+  gint scale = gtk_widget_get_scale_factor (widget);
+  guint i;
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    stream_set_size (stream, allocation->width * scale / data->columns, allocation->height * scale / data->rows);
+  }
+  placeholder_resize (data);
+}
+
+/* The main window was minimized, restored, or withdrawn from the screen */
+static gboolean window_state_cb (GtkWidget *widget, GdkEventWindowState *event, CustomData *data) {
+  data->iconified = (event->new_window_state & (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)) != 0;
+  tiles_update_visibility (data);
+  return FALSE;
+}
+
+/* This function is called when the main window is closed */
+static void delete_event_cb (GtkWidget *widget, GdkEvent *event, CustomData *data) {
+  guint i;
+
+  /* Set all pipelines of the GUI to READY state (they are set to NULL at the end of the program).
+   * The live stream pipelines belong to the control threads, stream_free stops them */
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    if (stream->display)
+      gst_element_set_state (stream->display, GST_STATE_READY);
+  }
+  if (data->compositor)
+    gst_element_set_state (data->compositor, GST_STATE_READY);
+  gst_element_set_state (data->placeholder, GST_STATE_READY);
+  gtk_main_quit ();
+}
+
+/* This function is called everytime the video window needs to be redrawn (due to damage/exposure,
+ * rescaling, etc). GStreamer takes care of this in the PAUSED and PLAYING states, otherwise,
+ * we simply draw a black rectangle to avoid garbage showing up. */
+static gboolean draw_cb (GtkWidget *widget, cairo_t *cr, VideoStream *stream) {
+  GtkAllocation allocation;
+  if (GST_STATE (stream->display) < GST_STATE_PAUSED) {
+    gtk_widget_get_allocation (widget, &allocation);
+    cairo_set_source_rgb (cr, 0, 0, 0);
+    cairo_rectangle (cr, 0, 0, allocation.width, allocation.height);
+    cairo_fill (cr);
+  }
+  return FALSE;
+}
+
+/* Same for the single video window in compositor mode */
+static gboolean wall_draw_cb (GtkWidget *widget, cairo_t *cr, CustomData *data) {
+  GtkAllocation allocation;
+  if (data->stateCompositor < GST_STATE_PAUSED) {
+    gtk_widget_get_allocation (widget, &allocation);
+    cairo_set_source_rgb (cr, 0, 0, 0);
+    cairo_rectangle (cr, 0, 0, allocation.width, allocation.height);
+    cairo_fill (cr);
+  }
+  return FALSE;
+}
+
+/* TRUE if a stream was placed at row, column already */
+static gboolean layout_taken (CustomData *data, guint row, guint column) {
+  guint i;
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    if (stream->row == row && stream->column == column)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Give every stream its place in the video wall and return the size of the grid. Streams with a row and column
+ * in the configuration go there, the others fill the free cells of a grid that is as square as possible */
+static void layout_assign (CustomData *data, guint *columns, guint *rows) {
+  guint i, cell = 0;
+
+  *columns = (guint) ceil (sqrt (data->streams->len));
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    if (stream->site->row >= 0 && stream->site->column >= 0) {
+      stream->row = stream->site->row;
+      stream->column = stream->site->column;
+      *columns = MAX (*columns, stream->column + 1);
+    } else {
+      stream->row = G_MAXUINT;
+      stream->column = G_MAXUINT;
+    }
+  }
+
+  *rows = 0;
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    if (stream->row == G_MAXUINT) {
+      while (layout_taken (data, cell / *columns, cell % *columns))
+        cell++;
+      stream->row = cell / *columns;
+      stream->column = cell % *columns;
+    }
+    *rows = MAX (*rows, stream->row + 1);
+  }
+}
+
+/* Create the drawing area of the tile of stream in its cell of the grid (window mode only) */
+static void tile_create_widget (CustomData *data, VideoStream *stream) {
+  GtkWidget *video_window = gtk_drawing_area_new ();
+
+  gtk_widget_set_double_buffered (video_window, FALSE);
+  gtk_widget_set_hexpand (video_window, TRUE);
+  gtk_widget_set_vexpand (video_window, TRUE);
+  g_signal_connect (video_window, "realize", G_CALLBACK (realize_cb), stream);
+  g_signal_connect (video_window, "draw", G_CALLBACK (draw_cb), stream);
+  /* Decoding stops for tiles that cannot be seen, and the frames are scaled to the size they are shown at */
+  gtk_widget_add_events (video_window, GDK_STRUCTURE_MASK | GDK_VISIBILITY_NOTIFY_MASK);
+  g_signal_connect (video_window, "map-event", G_CALLBACK (tile_event_cb), stream);
+  g_signal_connect (video_window, "unmap-event", G_CALLBACK (tile_event_cb), stream);
+  g_signal_connect (video_window, "visibility-notify-event", G_CALLBACK (tile_event_cb), stream);
+  g_signal_connect (video_window, "size-allocate", G_CALLBACK (tile_size_allocate_cb), stream);
+
+  gtk_grid_attach (GTK_GRID (data->grid), video_window, stream->column, stream->row, 1, 1);
+  stream->widget = video_window;
+}
+
+/* This creates all the GTK+ widgets that compose our application, and registers the callbacks.
+ * The tiles are laid out on the grid of layout_assign */
+static void create_ui (CustomData *data) {
+  GtkWidget *main_window;  /* The uppermost window, containing all other windows */
+  GtkWidget *video_window; /* The drawing area where the video of one stream will be shown */
+  GtkWidget *main_grid;    /* Grid holding one video_window per stream */
+  guint i;
+
+  main_window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  g_signal_connect (G_OBJECT (main_window), "delete-event", G_CALLBACK (delete_event_cb), data);
+  g_signal_connect (G_OBJECT (main_window), "window-state-event", G_CALLBACK (window_state_cb), data);
+
+  main_grid = gtk_grid_new ();
+  gtk_grid_set_row_homogeneous (GTK_GRID (main_grid), TRUE);
+  gtk_grid_set_column_homogeneous (GTK_GRID (main_grid), TRUE);
+
+  /* In compositor mode the mixer places the tiles, GTK only provides the one window it renders to */
+  if (use_compositor) {
+    video_window = gtk_drawing_area_new ();
+    gtk_widget_set_double_buffered (video_window, FALSE);
+    gtk_widget_set_hexpand (video_window, TRUE);
+    gtk_widget_set_vexpand (video_window, TRUE);
+    g_signal_connect (video_window, "realize", G_CALLBACK (wall_realize_cb), data);
+    g_signal_connect (video_window, "draw", G_CALLBACK (wall_draw_cb), data);
+    /* Decoding stops for tiles that cannot be seen */
+    gtk_widget_add_events (video_window, GDK_STRUCTURE_MASK | GDK_VISIBILITY_NOTIFY_MASK);
+    g_signal_connect (video_window, "map-event", G_CALLBACK (wall_event_cb), data);
+    g_signal_connect (video_window, "unmap-event", G_CALLBACK (wall_event_cb), data);
+    g_signal_connect (video_window, "visibility-notify-event", G_CALLBACK (wall_event_cb), data);
+    /* The frames are scaled to the size they are shown at before they reach the mixer */
+    g_signal_connect (video_window, "size-allocate", G_CALLBACK (wall_size_allocate_cb), data);
+    gtk_grid_attach (GTK_GRID (main_grid), video_window, 0, 0, 1, 1);
+  }
+
+  data->grid = main_grid;
+  layout_assign (data, &data->columns, &data->rows);
+  for (i = 0; i < data->streams->len && !use_compositor; i++)
+    tile_create_widget (data, g_ptr_array_index (data->streams, i));
+
+  gtk_container_add (GTK_CONTAINER (main_window), main_grid);
+  gtk_window_set_default_size (GTK_WINDOW (main_window), 1920, 1080);
+
+  gtk_widget_show_all (main_window);
+}
+
+/* Push a frame decoded by another pipeline into appsrc. caps holds the caps last set on appsrc,
+ * they are renegotiated whenever the frames pushed change in size.
+ * The buffer is a shallow copy sharing the frame memory. Its timestamps belong to the source pipeline,
+ * they are cleared so that appsrc stamps the frame with the running time of its own pipeline */
+static void appsrc_push_sample (GstElement *appsrc, GstCaps **caps, GstSample *sample) {
+  GstCaps *sample_caps;
+  GstBuffer *buffer;
+
+  sample_caps = gst_sample_get_caps (sample);
+  if (sample_caps && (!*caps || !gst_caps_is_equal (sample_caps, *caps))) {
+    gst_caps_replace (caps, sample_caps);
+    gst_app_src_set_caps (GST_APP_SRC (appsrc), sample_caps);
+  }
+  buffer = gst_buffer_copy (gst_sample_get_buffer (sample));
+  GST_BUFFER_PTS (buffer) = GST_CLOCK_TIME_NONE;
+  GST_BUFFER_DTS (buffer) = GST_CLOCK_TIME_NONE;
+  gst_app_src_push_buffer (GST_APP_SRC (appsrc), buffer);
+}
+
+/* The placeholder pipeline only has to decode while at least one tile shows the waiting video,
+ * this keeps the decoder idle while all live streams are up. Runs on the main thread */
+static gboolean placeholder_update (CustomData *data) {
+  gboolean idle = FALSE;
+  guint i;
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    if (!g_atomic_int_get (&stream->showLive))
+      idle = TRUE;
+  }
+  if (data->placeholder)
+    gst_element_set_state (data->placeholder, idle ? GST_STATE_PLAYING : GST_STATE_PAUSED);
+  return FALSE;
+}
+
+/* Switch the tile between the live stream and the waiting video. This is a single pad change on the input-selector
+ * of the tile, neither branch changes its state. The sink keeps the last frame until the new branch delivers one,
+ * so there is no black frame in between. Called from the main thread and from the live streaming thread */
+static void stream_select (VideoStream *stream, gboolean live) {
+  GstElement *selector;
+
+  if (!g_atomic_int_compare_and_exchange (&stream->showLive, !live, live))
+    return;
+
+  /* Headless or before its tile is built there is no tile to switch, stream_bind_tile picks the state up */
+  selector = g_atomic_pointer_get (&stream->selector);
+  if (selector)
+    g_object_set (selector, "active-pad", live ? stream->livePad : stream->waitPad, NULL);
+  g_print ("Stream %s shows %s\n", stream->site->name, live ? "the live stream" : "the waiting video");
+  g_idle_add ((GSourceFunc) placeholder_update, stream->app);
+}
+
+/* Seconds between the NTP epoch (1900) and the Unix epoch (1970) */
+#define NTP_UNIX_OFFSET G_GUINT64_CONSTANT (2208988800)
+
+/* Capture time of a frame in the clock of the sender, attached by rtpjitterbuffer from the RTCP sender reports */
+static GstStaticCaps ntp_caps = GST_STATIC_CAPS ("timestamp/x-ntp");
+
+/* Capture time of a frame as NTP time in nanoseconds, GST_CLOCK_TIME_NONE if it carries none */
+static GstClockTime buffer_capture_time (GstBuffer *buffer) {
+  GstReferenceTimestampMeta *meta;
+  GstCaps *caps;
+
+  caps = gst_static_caps_get (&ntp_caps);
+  meta = gst_buffer_get_reference_timestamp_meta (buffer, caps);
+  gst_caps_unref (caps);
+  return meta ? meta->timestamp : GST_CLOCK_TIME_NONE;
+}
+
+/* Current NTP time in nanoseconds: the shared clock once it follows its NTP server, else the system clock */
+static GstClockTime ntp_now (void) {
+  if (sync_clock && gst_clock_is_synced (sync_clock))
+    return gst_clock_get_time (sync_clock) + sync_clock_offset;
+  return (guint64) g_get_real_time () * GST_USECOND + NTP_UNIX_OFFSET * GST_SECOND;
+}
+
+/* Create the clock all live stream pipelines share in synced mode. It follows ntp_server if one is set, its time is
+ * NTP time then. Else it is the realtime system clock, which has to be synchronised to NTP like those of the camera
+ * servers, whose sender reports carry their capture times. It is not waited for: frames are shown as they come until
+ * the clock has synchronised */
+static gboolean sync_clock_create (void) {
+  if (ntp_server) {
+    sync_clock = gst_ntp_clock_new ("sync-clock", ntp_server, NTP_PORT, 0);
+    if (!sync_clock) {
+      g_printerr ("Unable to create a clock following the NTP server %s\n", ntp_server);
+      return FALSE;
+    }
+    sync_clock_offset = 0;
+  } else {
+    sync_clock = g_object_new (GST_TYPE_SYSTEM_CLOCK, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
+    sync_clock_offset = NTP_UNIX_OFFSET * GST_SECOND;
+  }
+  g_print ("Synced mode: frames are shown %d ms after their capture, by the clock of %s\n", sync_latency,
+      ntp_server ? ntp_server : "this system");
+  return TRUE;
+}
+
+/* Glass-to-glass latency of a frame in microseconds: the time from its capture, as stamped by the sender,
+ * until now. Needs sender and receiver synchronised to NTP. FALSE if the frame carries no capture time */
+static gboolean buffer_latency (GstBuffer *buffer, guint64 *latency) {
+  GstClockTime capture = buffer_capture_time (buffer);
+  guint64 now;
+
+  if (!GST_CLOCK_TIME_IS_VALID (capture))
+    return FALSE;
+
+  now = ntp_now ();
+  if (now < capture || now - capture > LATENCY_MAX * GST_SECOND)
+    return FALSE;
+  *latency = (now - capture) / GST_USECOND;
+  return TRUE;
+}
+
+/* Frames of the live stream are shown as soon as they arrive, in synced mode as soon as they are due, see sync_probe_cb.
+ * The first one switches the tile to the live branch.
+ * A standby pipeline is not shown before it has been promoted */
+static GstFlowReturn live_new_sample_cb (GstAppSink *sink, VideoStream *stream) {
+  GstSample *sample;
+  guint64 latency;
+
+  sample = gst_app_sink_pull_sample (sink);
+  if (!sample)
+    return GST_FLOW_EOS;
+  if (GST_OBJECT_PARENT (sink) == GST_OBJECT (g_atomic_pointer_get (&stream->videoStream))) {
+    g_mutex_lock (&stream->liveLock);
+    stream->lastLiveFrame = g_get_monotonic_time ();
+    stream_select (stream, TRUE);
+    if (stream->liveSrc)
+      appsrc_push_sample (stream->liveSrc, &stream->liveCaps, sample);
+    if (buffer_latency (gst_sample_get_buffer (sample), &latency)) {
+      METRIC_SET (stream->metrics.age, latency);
+      if (stream->latencies)
+        g_array_append_val (stream->latencies, latency);
+    }
+    g_mutex_unlock (&stream->liveLock);
+    METRIC_ADD (stream->metrics.shown, 1);
+  }
+  gst_sample_unref (sample);
+  return GST_FLOW_OK;
+}
+
+/* The waiting video is decoded once by the placeholder pipeline and fanned out from here
+ * to the waiting video branch of every tile that shows it */
+static GstFlowReturn placeholder_new_sample_cb (GstAppSink *sink, CustomData *data) {
+  GstSample *sample;
+  guint i;
+
+  sample = gst_app_sink_pull_sample (sink);
+  if (!sample)
+    return GST_FLOW_EOS;
+  g_mutex_lock (&data->streamsLock);
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    if (stream->waitSrc && !g_atomic_int_get (&stream->showLive))
+      appsrc_push_sample (stream->waitSrc, &stream->waitCaps, sample);
+  }
+  g_mutex_unlock (&data->streamsLock);
+  gst_sample_unref (sample);
+  return GST_FLOW_OK;
+}
+
+/* Register the new-sample callback on the appsink named "out" of pipeline */
+static void appsink_connect (GstElement *pipeline, const gchar *name, gpointer new_sample, gpointer user_data) {
+  GstAppSinkCallbacks callbacks = { NULL };
+  GstElement *sink;
+
+  callbacks.new_sample = new_sample;
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), name);
+  gst_app_sink_set_callbacks (GST_APP_SINK (sink), &callbacks, user_data, NULL);
+  gst_object_unref (sink);
+}
+
+/* Tiles whose live stream stalled without an error fall back to the waiting video after no_data_timeout,
+ * stream_stall_check_cb reconnects the stream later */
+static gboolean no_data_check_cb (CustomData *data) {
+  gint64 now = g_get_monotonic_time ();
+  guint i;
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+    gint64 last;
+
+    g_mutex_lock (&stream->liveLock);
+    last = stream->lastLiveFrame;
+    g_mutex_unlock (&stream->liveLock);
+    /* Hidden tiles decode nothing on purpose */
+    if (g_atomic_int_get (&stream->decoding) == DECODE_NONE)
+      continue;
+    if (g_atomic_int_get (&stream->showLive) && now - last > (gint64) no_data_timeout * 1000)
+      stream_select (stream, FALSE);
+  }
+  return TRUE;
+}
+
+/* Try to connect again after the current backoff delay. Only one reconnect may be pending,
+ * otherwise several pipelines would be started for this tile */
+static void stream_schedule_reconnect (VideoStream *stream) {
+  if (stream->reconnectSource)
+    return;
+  /* A standby pipeline that is still negotiating is the reconnect already */
+  if (stream->standbyStream && GST_STATE_TARGET (stream->standbyStream) == GST_STATE_PLAYING)
+    return;
+
+  g_print ("Reconnecting stream %s in %u ms\n", stream->site->name, stream->reconnect_delay);
+  METRIC_ADD (stream->metrics.reconnects, 1);
+  stream->reconnectSource = stream_timeout_add (stream, stream->reconnect_delay, (GSourceFunc) rtsp_client, stream);
+  stream->reconnect_delay = MIN (stream->reconnect_delay * 2, RECONNECT_DELAY_MAX);
+}
+
+/* Find the pipeline of the stream a bus message was posted by, NULL if it is from neither of them */
+static GstElement *stream_message_pipeline (VideoStream *stream, GstMessage *msg) {
+  GstElement *pipelines[] = { stream->videoStream, stream->standbyStream };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (pipelines); i++) {
+    if (pipelines[i] && (GST_MESSAGE_SRC (msg) == GST_OBJECT (pipelines[i]) ||
+        gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg), GST_OBJECT (pipelines[i]))))
+      return pipelines[i];
+  }
+  return NULL;
+}
+
+/* Dispose of a live stream pipeline of the stream for good, with its bus watch and handlers */
+static void stream_dispose_pipeline (VideoStream *stream, GstElement **pipeline) {
+  GstBus *bus;
+
+  if (!*pipeline)
+    return;
+  bus = gst_element_get_bus (*pipeline);
+  gst_bus_remove_signal_watch (bus);
+  g_signal_handlers_disconnect_by_data (bus, stream);
+  gst_object_unref (bus);
+  gst_element_set_state (*pipeline, GST_STATE_NULL);
+  gst_object_unref (*pipeline);
+  g_atomic_pointer_set (pipeline, NULL);
+}
+
+/* A pipeline of the stream failed or finished. It is reset to NULL, which keeps it for the next connect.
+ * If it was the one shown the waiting video takes over the tile. A standby pipeline that fails while it replaces
+ * the one shown takes that one along, see stream_replace */
+static void stream_connection_lost (VideoStream *stream, GstElement *pipeline) {
+  /* Set the streaming pipeline to ready state */
+  gst_element_set_state (pipeline, GST_STATE_READY);
+  /* Set the streaming pipline to null state, this resets all elements for the next connect */
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  if (pipeline == stream->standbyStream && stream->replacing) {
+    g_printerr ("Replacement of stream %s failed\n", stream->site->name);
+    stream_connection_lost (stream, stream->videoStream);
+    return;
+  }
+  if (pipeline == stream->videoStream) {
+    /* A standby pipeline still connecting is the reconnect now */
+    stream->replacing = FALSE;
+    /* The state change to NULL is not posted on the bus anymore */
+    stream->stateStream = GST_STATE_NULL;
+    /* Show the waiting video */
+    stream_select (stream, FALSE);
+  }
+  stream_schedule_reconnect (stream);
+}
+
+/* Start the stream over on a new connection without taking down the one shown first. With --standby the pipeline shown
+ * keeps playing and stays on the tile while the standby pipeline connects right away, without the backoff delay, and
+ * first_frame_cb shows it in its place. Only if the standby fails or times out the tile falls back to the waiting
+ * video. FALSE if there is no playing pipeline to keep or no --standby, the caller tears down and reconnects itself */
+static gboolean stream_replace (VideoStream *stream) {
+  if (!use_standby || !stream->videoStream || GST_STATE_TARGET (stream->videoStream) != GST_STATE_PLAYING)
+    return FALSE;
+  if (stream->replacing)
+    return TRUE;
+
+  g_print ("Replacing the connection of stream %s in the background\n", stream->site->name);
+  METRIC_ADD (stream->metrics.reconnects, 1);
+  stream_cancel_reconnect (stream);
+  stream->replacing = TRUE;
+  /* A standby pipeline already connecting after an earlier failure is the replacement */
+  if (!stream->standbyStream || GST_STATE_TARGET (stream->standbyStream) != GST_STATE_PLAYING)
+    rtsp_client (stream);
+  return TRUE;
+}
+
+/* This function is called when an End-Of-Stream message is posted on the bus.
+ * We stop the live stream and wait for it to come back */
+static void eos_cb (GstBus *bus, GstMessage *msg, VideoStream *stream) {
+  GstElement *pipeline = stream_message_pipeline (stream, msg);
+
+  g_print ("End-Of-Stream reached on stream %s.\n", stream->site->name);
+  if (pipeline)
+    stream_connection_lost (stream, pipeline);
+}
+
+/* Watchdog of the data flow of a stream. A frozen camera or a half-open connection posts neither an error nor an EOS,
+ * the pipeline only stops delivering frames. A playing pipeline without a frame out of its depayloader for stall_timeout,
+ * counted from its connect if it never had one, is replaced by a new connection. With --standby the stalled pipeline
+ * stays on the tile until the replacement decodes, see stream_replace, and a stalled standby counts as a failed one.
+ * Without, it is handled like a lost connection: the tile shows the waiting video and the stream reconnects.
+ * Runs on the control thread every STALL_CHECK_INTERVAL */
+static gboolean stream_stall_check_cb (VideoStream *stream) {
+  GstElement *pipelines[] = { stream->videoStream, stream->standbyStream };
+  gint64 now = g_get_monotonic_time ();
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (pipelines); i++) {
+    gint64 last = stream->connectTime, expected = 0;
+
+    if (!pipelines[i] || GST_STATE_TARGET (pipelines[i]) != GST_STATE_PLAYING)
+      continue;
+    /* A pipeline being replaced waits for its replacement, which has a timeout of its own */
+    if (pipelines[i] == stream->videoStream && stream->replacing)
+      continue;
+    /* A standby pipeline has no frames until it replaces the one shown */
+    if (pipelines[i] == stream->videoStream)
+      last = MAX (last, __atomic_load_n (&stream->lastData, __ATOMIC_RELAXED));
+    if (now - last <= (gint64) stall_timeout * 1000)
+      continue;
+
+    g_printerr ("Stream %s stalled, no frames for %" G_GINT64_FORMAT " ms, reconnecting\n", stream->site->name, (now - last) / 1000);
+    METRIC_ADD (stream->metrics.stalls, 1);
+    /* Reconnects that stall as well extend the stall that started with the last frame */
+    __atomic_compare_exchange_n (&stream->stallStart, &expected, last, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    if (pipelines[i] != stream->videoStream || !stream_replace (stream))
+      stream_connection_lost (stream, pipelines[i]);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* Feeds the watchdog with every frame out of the depayloader of the pipeline shown, and ends the stall of the stream
+ * if there was one. Runs on the streaming thread */
+static GstPadProbeReturn stall_probe_cb (GstPad *pad, GstPadProbeInfo *info, GstElement *pipeline) {
+  VideoStream *stream = g_object_get_data (G_OBJECT (pipeline), "stream");
+  gint64 now, start;
+
+  if (pipeline != g_atomic_pointer_get (&stream->videoStream))
+    return GST_PAD_PROBE_OK;
+  now = g_get_monotonic_time ();
+  __atomic_store_n (&stream->lastData, now, __ATOMIC_RELAXED);
+  start = __atomic_exchange_n (&stream->stallStart, 0, __ATOMIC_RELAXED);
+  if (start) {
+    METRIC_ADD (stream->metrics.stall_time, now - start);
+    METRIC_SET (stream->metrics.stall_last, now - start);
+    g_print ("Stream %s recovered from a stall of %" G_GINT64_FORMAT " ms\n", stream->site->name, (now - start) / 1000);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* This function is called when the pipeline changes states. We use it to
+ * keep track of the current state. What the tile shows follows the decoded frames, not the states,
+ * so state changes of child elements and of a standby pipeline are of no interest here */
+static void state_changed_cb (GstBus *bus, GstMessage *msg, VideoStream *stream) {
+  GstState old_state, new_state, pending_state;
+
+  if (GST_MESSAGE_SRC (msg) != GST_OBJECT (stream->videoStream))
+    return;
+
+  /* Parse received message */
+  gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
+  stream->stateStream = new_state;
+  g_print ("Streaming video %s state set to %s\n", stream->site->name, gst_element_state_get_name (new_state));
+}
+
+/* TRUE if the element that posted msg belongs to the recording branch of pipeline */
+static gboolean record_message (GstElement *pipeline, GstMessage *msg) {
+  GstElement *recorder = gst_bin_get_by_name (GST_BIN (pipeline), "recorder");
+  gboolean ret;
+
+  if (!recorder)
+    return FALSE;
+  ret = GST_MESSAGE_SRC (msg) == GST_OBJECT (recorder) || gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg), GST_OBJECT (recorder));
+  gst_object_unref (recorder);
+  return ret;
+}
+
+/* This function is called when an error message is posted on the bus */
+static void error_cb (GstBus *bus, GstMessage *msg, VideoStream *stream) {
+  GstElement *pipeline = stream_message_pipeline (stream, msg);
+  GstElement *decoder = NULL;
+  gchar *failed = NULL;
+  GError *err;
+  gchar *debug_info;
+
+  /* Print error details on the screen */
+  gst_message_parse_error (msg, &err, &debug_info);
+  g_printerr ("Error received from element %s of stream %s: %s\n", GST_OBJECT_NAME (msg->src), stream->site->name, err->message);
+  g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+  g_clear_error (&err);
+  g_free (debug_info);
+
+  if (!pipeline)
+    return;
+
+  /* record_sync_handler already cut the recorder off, the live stream goes on */
+  if (record_message (pipeline, msg)) {
+    g_printerr ("Recording of stream %s stopped until the stream is restarted\n", stream->site->name);
+    return;
+  }
+
+  /* A failing decoder is replaced by the next one of the ranking. The pipeline is built again for it
+   * instead of being reused, the other pipeline of the stream picks the new decoder up the next time it is built */
+  decoder = gst_bin_get_by_name (GST_BIN (pipeline), "dec");
+  if (decoder && (GST_MESSAGE_SRC (msg) == GST_OBJECT (decoder) || gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg), GST_OBJECT (decoder)))) {
+    GstElementFactory *factory = gst_element_get_factory (decoder);
+
+    failed = g_strdup (gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory)));
+  }
+  if (decoder)
+    gst_object_unref (decoder);
+
+  /* Stop the pipeline, show the waiting video if it was shown and try again later */
+  stream_connection_lost (stream, pipeline);
+  if (failed && stream_decoder_fallback (stream, failed))
+    stream_dispose_pipeline (stream, pipeline == stream->videoStream ? &stream->videoStream : &stream->standbyStream);
+  g_free (failed);
+}
+
+/* Runs on the control thread once a (re)started pipeline decoded its first frame. The connection counts as
+ * established, so the backoff starts over. A standby pipeline now replaces the one shown, which is torn down */
+static gboolean first_frame_cb (GstElement *pipeline) {
+  VideoStream *stream = g_object_get_data (G_OBJECT (pipeline), "stream");
+  GstElement *old;
+
+  /* The pipeline may have failed again in the meantime */
+  if (GST_STATE_TARGET (pipeline) != GST_STATE_PLAYING)
+    return FALSE;
+
+  METRIC_SET (stream->metrics.first_frame, g_get_monotonic_time () - stream->connectTime);
+  g_print ("First frame of stream %s decoded %" G_GUINT64_FORMAT " ms after connecting, %" G_GINT64_FORMAT " ms after startup\n",
+      stream->site->name, METRIC_GET (stream->metrics.first_frame) / 1000, (g_get_monotonic_time () - startup_time) / 1000);
+  stream->reconnect_delay = RECONNECT_DELAY_MIN;
+  g_mutex_lock (&stream->liveLock);
+  stream->firstFrameTime = g_get_monotonic_time ();
+  g_mutex_unlock (&stream->liveLock);
+
+  if (pipeline == stream->standbyStream) {
+    old = stream->videoStream;
+    g_atomic_pointer_set (&stream->videoStream, pipeline);
+    stream->standbyStream = old;
+    stream->replacing = FALSE;
+    if (old)
+      gst_element_set_state (old, GST_STATE_NULL);
+    stream->stateStream = GST_STATE_PLAYING;
+  }
+  return FALSE;
+}
+
+/* Keeps the frames of hidden tiles away from the decoder. The rtsp session goes on, the recorder and the relay still get every
+ * frame, only decoding stops. Once the tile can be seen again, frames are passed from the next keyframe on, the keyframe is
+ * requested upstream right away instead of waiting for the camera to send one. A pipeline that has not decoded its first
+ * frame yet gets every frame, so hidden tiles still notice when their stream comes back */
+static GstPadProbeReturn decode_probe_cb (GstPad *pad, GstPadProbeInfo *info, GstElement *pipeline) {
+  VideoStream *stream = g_object_get_data (G_OBJECT (pipeline), "stream");
+  gint state = g_atomic_int_get (&stream->decoding);
+  gint wait = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (pipeline), "keyframe-wait"));
+
+  /* A new connection starts decoding at its first keyframe, the frames before it cannot be decoded */
+  if (wait) {
+    if (GST_BUFFER_FLAG_IS_SET (GST_PAD_PROBE_INFO_BUFFER (info), GST_BUFFER_FLAG_DELTA_UNIT) && wait > 1) {
+      if (wait == KEYFRAME_WAIT_FRAMES)
+        gst_pad_push_event (pad, gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE, 0));
+      g_object_set_data (G_OBJECT (pipeline), "keyframe-wait", GINT_TO_POINTER (wait - 1));
+      return GST_PAD_PROBE_DROP;
+    }
+    g_object_set_data (G_OBJECT (pipeline), "keyframe-wait", NULL);
+  }
+
+  if (state == DECODE_ALL || g_object_get_data (G_OBJECT (pipeline), "first-frame-pending"))
+    return GST_PAD_PROBE_OK;
+  if (state == DECODE_NONE)
+    return GST_PAD_PROBE_DROP;
+  if (!GST_BUFFER_FLAG_IS_SET (GST_PAD_PROBE_INFO_BUFFER (info), GST_BUFFER_FLAG_DELTA_UNIT)) {
+    g_atomic_int_compare_and_exchange (&stream->decoding, state, DECODE_ALL);
+    return GST_PAD_PROBE_OK;
+  }
+  if (g_atomic_int_compare_and_exchange (&stream->decoding, DECODE_RESUME, DECODE_KEYFRAME))
+    gst_pad_push_event (pad, gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE, 0));
+  return GST_PAD_PROBE_DROP;
+}
+
+/* Buffer probe on the decoder output, reports the first frame after every (re)start to the control thread */
+static GstPadProbeReturn first_frame_probe_cb (GstPad *pad, GstPadProbeInfo *info, GstElement *pipeline) {
+  VideoStream *stream = g_object_get_data (G_OBJECT (pipeline), "stream");
+
+  if (g_object_get_data (G_OBJECT (pipeline), "first-frame-pending")) {
+    g_object_set_data (G_OBJECT (pipeline), "first-frame-pending", NULL);
+    stream_invoke (stream, (GSourceFunc) first_frame_cb, gst_object_ref (pipeline), (GDestroyNotify) gst_object_unref);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Buffer probe on the jitterbuffer output counting RTP packets */
+static GstPadProbeReturn metrics_packet_probe_cb (GstPad *pad, GstPadProbeInfo *info, VideoStream *stream) {
+  METRIC_ADD (stream->metrics.packets, 1);
+  METRIC_ADD (stream->metrics.bytes, gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info)));
+  return GST_PAD_PROBE_OK;
+}
+
+/* Buffer probe on the depayloader output counting the frames received */
+static GstPadProbeReturn metrics_received_probe_cb (GstPad *pad, GstPadProbeInfo *info, VideoStream *stream) {
+  METRIC_ADD (stream->metrics.received, 1);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Buffer probe on the decoder output counting the frames decoded */
+static GstPadProbeReturn metrics_decoded_probe_cb (GstPad *pad, GstPadProbeInfo *info, VideoStream *stream) {
+  METRIC_ADD (stream->metrics.decoded, 1);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Buffer probe on the appsink input measuring the glass-to-glass latency */
+static GstPadProbeReturn metrics_latency_probe_cb (GstPad *pad, GstPadProbeInfo *info, VideoStream *stream) {
+  guint64 latency;
+  guint i;
+
+  if (!buffer_latency (GST_PAD_PROBE_INFO_BUFFER (info), &latency))
+    return GST_PAD_PROBE_OK;
+
+  METRIC_ADD (stream->metrics.latency_count, 1);
+  METRIC_ADD (stream->metrics.latency_sum, latency);
+  METRIC_SET (stream->metrics.latency_last, latency);
+  for (i = 0; i < G_N_ELEMENTS (latency_buckets); i++) {
+    if (latency <= latency_buckets[i] * G_GUINT64_CONSTANT (1000)) {
+      METRIC_ADD (stream->metrics.latency_bucket[i], 1);
+      break;
+    }
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Set the latency of the stream on the jitterbuffer of the pipeline, and on the one of the standby pipeline */
+static void stream_set_latency (VideoStream *stream, guint latency) {
+  GstElement *pipelines[] = { stream->videoStream, stream->standbyStream };
+  guint i;
+
+  stream->latency = latency;
+  METRIC_SET (stream->metrics.latency, latency);
+  for (i = 0; i < G_N_ELEMENTS (pipelines); i++) {
+    GstElement *jitterbuffer;
+
+    if (!pipelines[i])
+      continue;
+    jitterbuffer = gst_bin_get_by_name (GST_BIN (pipelines[i]), "jitterbuffer");
+    g_object_set (jitterbuffer, "latency", latency, NULL);
+    gst_object_unref (jitterbuffer);
+  }
+}
+
+/* Turn retransmission requests on the pipelines of the stream on or off. rtspsrc negotiates retransmission when
+ * it sets the stream up, so this takes effect with the next connection */
+static void stream_set_retransmission (VideoStream *stream, gboolean retransmission) {
+  GstElement *pipelines[] = { stream->videoStream, stream->standbyStream };
+  const gchar *names[] = { "src", "jitterbuffer" };
+  guint i, j;
+
+  stream->retransmission = retransmission;
+  for (i = 0; i < G_N_ELEMENTS (pipelines); i++) {
+    for (j = 0; pipelines[i] && j < G_N_ELEMENTS (names); j++) {
+      GstElement *element = gst_bin_get_by_name (GST_BIN (pipelines[i]), names[j]);
+
+      g_object_set (element, "do-retransmission", retransmission, NULL);
+      gst_object_unref (element);
+    }
+  }
+}
+
+/* Adaptive latency controller. Once a window of ADAPT_WINDOW_PACKETS is complete its loss rate, lost and late packets,
+ * is compared to the target loss of the site: above it the latency grows by half, at least enough to cover four times
+ * the jitter. After ADAPT_QUIET_WINDOWS windows below a quarter of the target it shrinks by a tenth. It always stays
+ * between the bounds of the site. Loss above retransmission_loss turns on retransmission for the next connection */
+static void stream_adapt_latency (VideoStream *stream, guint64 pushed, guint64 lost, guint64 late, guint64 jitter) {
+  StreamSite *site = stream->site;
+  guint latency_min = site->latency_min >= 0 ? (guint) site->latency_min : site->latency;
+  guint jitter_ms = (guint) (jitter / GST_MSECOND);
+  guint latency = stream->latency;
+  gdouble loss;
+
+  /* The counters start over with every connection */
+  if (pushed < stream->adaptPushed || lost < stream->adaptLost || late < stream->adaptLate)
+    stream->adaptPushed = stream->adaptLost = stream->adaptLate = 0;
+  stream->windowPackets += (pushed - stream->adaptPushed) + (lost - stream->adaptLost);
+  stream->windowLoss += (lost - stream->adaptLost) + (late - stream->adaptLate);
+  stream->adaptPushed = pushed;
+  stream->adaptLost = lost;
+  stream->adaptLate = late;
+  if (stream->windowPackets < ADAPT_WINDOW_PACKETS)
+    return;
+
+  loss = 100.0 * stream->windowLoss / stream->windowPackets;
+  stream->windowPackets = 0;
+  stream->windowLoss = 0;
+
+  if (site->retransmission_loss > 0 && loss > site->retransmission_loss && !stream->retransmission) {
+    g_print ("Stream %s: %.1f %% loss, requesting retransmission from the next connection on\n", site->name, loss);
+    stream_set_retransmission (stream, TRUE);
+  }
+
+  if (!site->adaptive_latency || site->latency_max <= latency_min)
+    return;
+  if (loss > site->target_loss) {
+    stream->quietWindows = 0;
+    latency = MAX (MAX (latency * 3 / 2, latency + 10), jitter_ms * 4);
+  } else if (loss < site->target_loss / 4 && ++stream->quietWindows >= ADAPT_QUIET_WINDOWS) {
+    stream->quietWindows = 0;
+    latency = MAX (latency * 9 / 10, jitter_ms * 4);
+  }
+  latency = CLAMP (latency, latency_min, site->latency_max);
+  if (latency == stream->latency)
+    return;
+
+  g_print ("Stream %s: %.1f %% loss (target %.1f %%), %u ms jitter, latency %u -> %u ms\n",
+      site->name, loss, site->target_loss, jitter_ms, stream->latency, latency);
+  stream_set_latency (stream, latency);
+}
+
+/* Runs on the control thread once a second: copy what the jitterbuffer of the pipeline shown reports about itself
+ * into the metrics and let the adaptive latency controller look at it. These belong to the pipeline and start over
+ * when it is rebuilt */
+static gboolean stream_stats_cb (VideoStream *stream) {
+  GstElement *jitterbuffer;
+  GstStructure *stats = NULL;
+  guint64 pushed = 0, lost = 0, late = 0, jitter = 0;
+  gint percent = 0;
+
+  if (!stream->videoStream)
+    return TRUE;
+  jitterbuffer = gst_bin_get_by_name (GST_BIN (stream->videoStream), "jitterbuffer");
+  g_object_get (jitterbuffer, "percent", &percent, "stats", &stats, NULL);
+  gst_object_unref (jitterbuffer);
+  if (stats) {
+    gst_structure_get_uint64 (stats, "num-pushed", &pushed);
+    gst_structure_get_uint64 (stats, "num-lost", &lost);
+    gst_structure_get_uint64 (stats, "num-late", &late);
+    gst_structure_get_uint64 (stats, "avg-jitter", &jitter);
+    gst_structure_free (stats);
+  }
+  METRIC_SET (stream->metrics.jitterbuffer_percent, (guint64) MAX (percent, 0));
+  METRIC_SET (stream->metrics.lost, lost);
+  METRIC_SET (stream->metrics.late, late);
+  stream_adapt_latency (stream, pushed, lost, late, jitter);
+  return TRUE;
+}
+
+/* Add a buffer probe to a static pad of the element called name in pipeline */
+static void metrics_add_probe (GstElement *pipeline, const gchar *name, const gchar *pad_name, gpointer probe, VideoStream *stream) {
+  GstElement *element;
+  GstPad *pad;
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), name);
+  pad = gst_element_get_static_pad (element, pad_name);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) probe, stream, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (element);
+}
+
+/* Directory holding the segment ring of the stream of a site, free with g_free */
+static gchar *record_ring_directory (const gchar *name) {
+  return g_build_filename (record_directory, name, NULL);
+}
+
+static GstPadProbeReturn record_drop_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  return GST_PAD_PROBE_DROP;
+}
+
+/* Runs on the streaming thread of the recorder as soon as it fails (disk full or gone). The recording branch is cut
+ * off at its queue before the error flows back into the tee, so the live stream keeps playing without it */
+static GstBusSyncReply record_sync_handler (GstBus *bus, GstMessage *msg, GstElement *pipeline) {
+  GstElement *queue;
+  GstPad *pad;
+
+  if (GST_MESSAGE_TYPE (msg) != GST_MESSAGE_ERROR || !record_message (pipeline, msg) ||
+      g_object_get_data (G_OBJECT (pipeline), "record-failed"))
+    return GST_BUS_PASS;
+  g_object_set_data (G_OBJECT (pipeline), "record-failed", GINT_TO_POINTER (TRUE));
+  queue = gst_bin_get_by_name (GST_BIN (pipeline), "recordqueue");
+  pad = gst_element_get_static_pad (queue, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM, record_drop_probe_cb, NULL, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (queue);
+  return GST_BUS_PASS;
+}
+
+/* Set up the recording branch of a live stream pipeline: splitmuxsink cuts the H.264 into MPEG-TS segments of
+ * record_segment seconds at keyframes and keeps the newest ones covering record_length seconds, reusing the files
+ * of the oldest. Nothing is decoded or encoded again for it */
+static void stream_setup_recorder (VideoStream *stream, GstElement *pipeline) {
+  gchar *directory = record_ring_directory (stream->site->name);
+  gchar *location = g_build_filename (directory, "segment%05d.ts", NULL);
+  GstElement *element;
+  GstBus *bus;
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "recordqueue");
+  g_object_set (element, "max-size-time", (guint64) RECORD_QUEUE_TIME * GST_MSECOND, NULL);
+  gst_object_unref (element);
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "recorder");
+  g_object_set (element, "location", location, "max-size-time", (guint64) record_segment * GST_SECOND,
+      "max-files", (guint) ((record_length + record_segment - 1) / record_segment + 1),
+      "muxer", gst_element_factory_make ("mpegtsmux", NULL), NULL);
+  gst_object_unref (element);
+  g_free (location);
+  g_free (directory);
+
+  bus = gst_element_get_bus (pipeline);
+  gst_bus_set_sync_handler (bus, (GstBusSyncHandler) record_sync_handler, pipeline, NULL);
+  gst_object_unref (bus);
+}
+
+/* TRUE if the live stream pipelines of stream get a recording branch: the site is recorded and its ring can be written */
+static gboolean stream_records (VideoStream *stream) {
+  gchar *directory;
+  gboolean ret = TRUE;
+
+  if (!stream->site->record)
+    return FALSE;
+  directory = record_ring_directory (stream->site->name);
+  if (g_mkdir_with_parents (directory, 0755) < 0) {
+    g_printerr ("Unable to create the recording directory %s of stream %s, it is not recorded: %s\n", directory,
+        stream->site->name, g_strerror (errno));
+    ret = FALSE;
+  }
+  g_free (directory);
+  return ret;
+}
+
+/* Hands the parsed H.264 of the live stream shown to the clients of its relay. Runs on the streaming thread of the
+ * relay branch */
+static GstFlowReturn relay_new_sample_cb (GstAppSink *sink, VideoStream *stream) {
+  StreamRelay *relay = stream->relay;
+  GstSample *sample;
+  gboolean keyframe = FALSE;
+
+  sample = gst_app_sink_pull_sample (sink);
+  if (!sample)
+    return GST_FLOW_EOS;
+  /* A standby pipeline feeds the relay once it is shown, the clients never get the same frames twice */
+  if (GST_OBJECT_PARENT (sink) == GST_OBJECT (g_atomic_pointer_get (&stream->videoStream))) {
+    g_mutex_lock (&relay->lock);
+    if (relay->appsrc) {
+      appsrc_push_sample (relay->appsrc, &relay->caps, sample);
+      keyframe = relay->keyframe;
+      relay->keyframe = FALSE;
+    }
+    g_mutex_unlock (&relay->lock);
+  }
+  gst_sample_unref (sample);
+
+  /* New clients can only start at a keyframe, ask the camera for one rather than waiting out its GOP */
+  if (keyframe) {
+    GstPad *pad = gst_element_get_static_pad (GST_ELEMENT (sink), "sink");
+
+    gst_pad_push_event (pad, gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE, 0));
+    gst_object_unref (pad);
+  }
+  return GST_FLOW_OK;
+}
+
+/* Synced mode: the frames are stamped with their capture time, in the running time of a pipeline that runs on the
+ * shared clock from its time 0. The appsink then hands each frame on sync_latency after its capture, in step with the
+ * other tiles, while the frames waiting for that pile up in syncqueue in front of the decoder. Frames without a capture
+ * time, and all frames while the clock has not synchronised yet, are handed on right away.
+ * The segment is replaced by one starting at 0 to match the stamps */
+static GstPadProbeReturn sync_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  GstClockTime capture;
+  GstBuffer *buffer;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstSegment segment;
+
+    if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) != GST_EVENT_SEGMENT)
+      return GST_PAD_PROBE_OK;
+    gst_segment_init (&segment, GST_FORMAT_TIME);
+    gst_event_unref (GST_PAD_PROBE_INFO_EVENT (info));
+    info->data = gst_event_new_segment (&segment);
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = gst_buffer_make_writable (GST_PAD_PROBE_INFO_BUFFER (info));
+  info->data = buffer;
+  capture = buffer_capture_time (buffer);
+  if (GST_CLOCK_TIME_IS_VALID (capture) && gst_clock_is_synced (sync_clock) && capture > sync_clock_offset)
+    GST_BUFFER_PTS (buffer) = capture - sync_clock_offset;
+  else
+    GST_BUFFER_PTS (buffer) = GST_CLOCK_TIME_NONE;
+  GST_BUFFER_DTS (buffer) = GST_CLOCK_TIME_NONE;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Put a live stream pipeline on the shared clock of synced mode, see sync_probe_cb. rtspsrc maps the RTP timestamps
+ * to the capture times of the RTCP sender reports on the same timescale. The wait for the frames to be due is taken
+ * up by syncqueue, which holds twice the latency budget. The jitterbuffer keeps passing the packets on as they come,
+ * so it drops none as late and the adaptive latency controller only sees the loss of the network */
+static void stream_setup_sync (VideoStream *stream, GstElement *pipeline) {
+  GstElement *element;
+  GstPad *pad;
+
+  gst_pipeline_use_clock (GST_PIPELINE (pipeline), sync_clock);
+  gst_element_set_start_time (pipeline, GST_CLOCK_TIME_NONE);
+  gst_element_set_base_time (pipeline, 0);
+  gst_pipeline_set_latency (GST_PIPELINE (pipeline), (GstClockTime) sync_latency * GST_MSECOND);
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "syncqueue");
+  g_object_set (element, "max-size-time", (guint64) MAX (sync_latency, 1) * 2 * GST_MSECOND, NULL);
+  gst_object_unref (element);
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  g_object_set (element, "ntp-sync", TRUE, NULL);
+  gst_util_set_object_arg (G_OBJECT (element), "ntp-time-source", ntp_server ? "clock-time" : "ntp");
+  gst_object_unref (element);
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "out");
+  g_object_set (element, "sync", TRUE, NULL);
+  pad = gst_element_get_static_pad (element, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, sync_probe_cb, NULL, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (element);
+}
+
+/* Set up the relay branch of a live stream pipeline, see relay_create_factory */
+static void stream_setup_relay (VideoStream *stream, GstElement *pipeline) {
+  GstElement *queue = gst_bin_get_by_name (GST_BIN (pipeline), "relayqueue");
+
+  g_object_set (queue, "max-size-time", (guint64) RELAY_QUEUE_TIME * GST_MSECOND, NULL);
+  gst_object_unref (queue);
+  appsink_connect (pipeline, "relay", relay_new_sample_cb, stream);
+}
+
+/* Create a live stream pipeline. It is created once and then reused for every reconnect of the stream,
+ * going to NULL state resets it completely */
+static GstElement *stream_create_pipeline (VideoStream *stream) {
+  StreamSite *site = stream->site;
+  GstElement *pipeline;
+  GstElement *element;
+  GError *error=NULL;
+  gchar *pipe_desc, *scale;
+  GstBus *bus;
+  GstPad *pad;
+  gboolean record = stream_records (stream);
+  gboolean relay = stream->relay != NULL;
+
+  /* Create the elements, the settings of the site are set on them as properties so they need no quoting.
+   * A recorded or relayed stream tees the parsed H.264 off to the recorder and the relay, each behind a leaky queue.
+   * The decoder stays on the first branch of the tee, so it gets every frame first and neither a slow disk nor a slow
+   * relay holds it up.
+   * In synced mode the decoder is fed through a queue of its own, the appsink holding the frames until they are due
+   * backs up into that queue only and never into the jitterbuffer, the tee or the other branches.
+   * The decoded frames are scaled to the tile before they leave the pipeline */
+  scale = scaler_desc ();
+  pipe_desc= g_strdup_printf ("rtspsrc name=src latency=0 do-retransmission=false ! rtpjitterbuffer name=jitterbuffer mode=2 ! application/x-rtp, encoding-name=H264 ! rtph264depay name=depay ! h264parse config-interval=-1 ! capsfilter caps='video/x-h264, stream-format=byte-stream, frame-rate=30/1' ! %s%s%s name=dec ! %sappsink name=out sync=false async=false max-buffers=1 drop=true%s%s",
+      record || relay ? "tee name=split allow-not-linked=true ! " : "",
+      sync_clock ? "queue name=syncqueue leaky=downstream max-size-buffers=0 max-size-bytes=0 ! " : "",
+      stream_decoder_desc (stream), scale,
+      record ? " split. ! queue name=recordqueue leaky=downstream max-size-buffers=0 max-size-bytes=0 ! splitmuxsink name=recorder" : "",
+      relay ? " split. ! queue name=relayqueue leaky=downstream max-size-buffers=0 max-size-bytes=0 ! appsink name=relay sync=false async=false" : "");
+  pipeline=gst_parse_launch(pipe_desc, &error);
+  g_free(pipe_desc);
+  g_free (scale);
+  if (!pipeline) {
+    g_printerr ("Unable to create the pipeline of stream %s: %s\n", stream->site->name, error->message);
+    g_clear_error (&error);
+    return NULL;
+  }
+  g_clear_error (&error);
+  g_object_set_data (G_OBJECT (pipeline), "stream", stream);
+  appsink_connect (pipeline, "out", live_new_sample_cb, stream);
+  if (record)
+    stream_setup_recorder (stream, pipeline);
+  if (relay)
+    stream_setup_relay (stream, pipeline);
+  if (sync_clock)
+    stream_setup_sync (stream, pipeline);
+  pipeline_set_size (pipeline, g_atomic_int_get (&stream->tileWidth), g_atomic_int_get (&stream->tileHeight));
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  g_object_set (element, "location", site->location, NULL);
+  if (site->user_id)
+    g_object_set (element, "user-id", site->user_id, "user-pw", site->user_pw, NULL);
+  g_object_set (element, "do-retransmission", stream->retransmission, NULL);
+  /* Stamp the frames with their capture time for the latency metrics, rtspsrc has this since GStreamer 1.22 */
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), "add-reference-timestamp-meta"))
+    g_object_set (element, "add-reference-timestamp-meta", TRUE, NULL);
+  gst_object_unref (element);
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "jitterbuffer");
+  g_object_set (element, "latency", stream->latency, "drop-on-latency", site->drop_on_latency,
+      "do-retransmission", stream->retransmission, NULL);
+  gst_object_unref (element);
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "dec");
+  pad = gst_element_get_static_pad (element, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) decode_probe_cb, pipeline, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (element, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) first_frame_probe_cb, pipeline, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (element);
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "depay");
+  pad = gst_element_get_static_pad (element, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) stall_probe_cb, pipeline, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (element);
+
+  metrics_add_probe (pipeline, "jitterbuffer", "src", metrics_packet_probe_cb, stream);
+  metrics_add_probe (pipeline, "depay", "src", metrics_received_probe_cb, stream);
+  metrics_add_probe (pipeline, "dec", "src", metrics_decoded_probe_cb, stream);
+  metrics_add_probe (pipeline, "out", "sink", metrics_latency_probe_cb, stream);
+
+  /* Instruct the bus to emit signals for each received message, and connect to the interesting signals */
+  bus = gst_element_get_bus (pipeline);
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (G_OBJECT (bus), "message::error", (GCallback)error_cb, stream);
+  g_signal_connect (G_OBJECT (bus), "message::eos", (GCallback)eos_cb, stream);
+  g_signal_connect (G_OBJECT (bus), "message::state-changed", (GCallback)state_changed_cb, stream);
+  gst_object_unref (bus);
+  return pipeline;
+}
+
+/* The pipeline the next connect of the stream plays, created if there is none. A pipeline is reset to NULL after every
+ * connection and reused by the next one, with its bus watch, handlers and probes. After PIPELINE_REUSE_MAX connects
+ * it is disposed of and built again instead, so whatever its elements keep from one connection to the next stays
+ * bounded however flaky the link is. A pipeline built with settings the stream no longer has is built again as well.
+ * NULL if it cannot be created. Control thread only */
+static GstElement *stream_pipeline_acquire (VideoStream *stream, GstElement **pipeline) {
+  if (*pipeline && GST_STATE (*pipeline) <= GST_STATE_READY &&
+      (GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (*pipeline), "connects")) >= PIPELINE_REUSE_MAX ||
+       g_object_get_data (G_OBJECT (*pipeline), "stale")))
+    stream_dispose_pipeline (stream, pipeline);
+  if (!*pipeline)
+    g_atomic_pointer_set (pipeline, stream_create_pipeline (stream));
+  return *pipeline;
+}
+
+/* (re)start thread for a live video stream. Without --standby the pipeline shown is restarted directly,
+ * with --standby the standby pipeline is started and replaces it in first_frame_cb, see stream_replace */
+static gboolean rtsp_client (VideoStream *stream)
+{
+  GstElement **pipeline;
+  GstStateChangeReturn ret;
+
+  /* The source calling this is done */
+  if (stream->reconnectSource) {
+    g_source_unref (stream->reconnectSource);
+    stream->reconnectSource = NULL;
+  }
+  pipeline = use_standby ? &stream->standbyStream : &stream->videoStream;
+  if (!stream_pipeline_acquire (stream, pipeline)) {
+    /* Without a replacement the pipeline shown cannot stay either */
+    if (stream->replacing)
+      stream_connection_lost (stream, stream->videoStream);
+    else
+      stream_schedule_reconnect (stream);
+    return FALSE;
+  }
+
+  /* Start playing */
+  g_object_set_data (G_OBJECT (*pipeline), "connects",
+      GUINT_TO_POINTER (GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (*pipeline), "connects")) + 1));
+  g_object_set_data (G_OBJECT (*pipeline), "first-frame-pending", GINT_TO_POINTER (TRUE));
+  g_object_set_data (G_OBJECT (*pipeline), "keyframe-wait", GINT_TO_POINTER (KEYFRAME_WAIT_FRAMES));
+  stream->connectTime = g_get_monotonic_time ();
+  ret=gst_element_set_state (*pipeline, GST_STATE_PLAYING);
+  if (ret==GST_STATE_CHANGE_FAILURE) {
+    g_printerr ("Unable to set the pipeline of stream %s to the playing state.\n", stream->site->name);
+    stream_connection_lost (stream, *pipeline);
+  }
+  /* return FALSE to make sure function is only called once */
+  return FALSE;
+}
+
+/* Create the pipeline the next connect of the stream plays and take it to READY, which opens its decoder and the
+ * scaler, so a delayed connect has only the rtsp handshake left. Control thread only */
+static gboolean stream_prewarm_cb (VideoStream *stream) {
+  GstElement **pipeline = use_standby ? &stream->standbyStream : &stream->videoStream;
+
+  if (stream_pipeline_acquire (stream, pipeline))
+    gst_element_set_state (*pipeline, GST_STATE_READY);
+  return FALSE;
+}
+
+/* First connect of a stream, after the startup delay of its site. Invoked on the control thread, which is the only one
+ * setting reconnectSource: the connect cannot run and clear it before it has been set */
+static gboolean stream_connect_cb (VideoStream *stream) {
+  if (!stream->site->startup_delay)
+    return rtsp_client (stream);
+  stream_prewarm_cb (stream);
+  stream->reconnectSource = stream_timeout_add (stream, stream->site->startup_delay * 1000, (GSourceFunc) rtsp_client, stream);
+  return FALSE;
+}
+
+/* A stream whose site was replaced, and the site it had before */
+typedef struct _StreamRestart {
+  VideoStream *stream;
+  StreamSite *old;
+} StreamRestart;
+
+/* Runs on the control thread after the main thread gave the stream new settings: its pipelines are created again
+ * from scratch and connect right away. With --standby a playing pipeline stays on the tile until the new one decodes,
+ * it is only marked to be built again instead of being reused. The old site is freed only here, once nothing of the
+ * stream uses it anymore */
+static gboolean stream_restart_cb (StreamRestart *restart) {
+  VideoStream *stream = restart->stream;
+  gboolean keep = use_standby && stream->videoStream && GST_STATE_TARGET (stream->videoStream) == GST_STATE_PLAYING;
+
+  stream_cancel_reconnect (stream);
+  stream->replacing = FALSE;
+  if (keep) {
+    g_object_set_data (G_OBJECT (stream->videoStream), "stale", GINT_TO_POINTER (TRUE));
+  } else {
+    stream_dispose_pipeline (stream, &stream->videoStream);
+    stream->stateStream = GST_STATE_NULL;
+    stream_select (stream, FALSE);
+  }
+  stream_dispose_pipeline (stream, &stream->standbyStream);
+
+  site_free (restart->old);
+  stream->decoder_rank = stream->site->decoder ? -1 : 0;
+  stream->reconnect_delay = RECONNECT_DELAY_MIN;
+  stream->retransmission = FALSE;
+  stream_set_latency (stream, stream->site->latency);
+  if (!keep || !stream_replace (stream))
+    rtsp_client (stream);
+  g_free (restart);
+  return FALSE;
+}
+
+/* Start the stream over with the settings of site, which it takes over */
+static void stream_restart (VideoStream *stream, StreamSite *site) {
+  StreamRestart *restart = g_new0 (StreamRestart, 1);
+
+  restart->stream = stream;
+  restart->old = stream->site;
+  stream->site = site;
+  stream_invoke (stream, (GSourceFunc) stream_restart_cb, restart, NULL);
+}
+
+/* Warn about every key of [general] that was added, removed or changed in key_file since startup. The settings stay
+ * as they are, see config_load_general */
+static void config_check_general (GKeyFile *key_file) {
+  GKeyFile *files[] = { config_running, key_file };
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (files); i++) {
+    gchar **keys = g_key_file_get_keys (files[i], "general", NULL, NULL);
+
+    for (j = 0; keys && keys[j]; j++) {
+      gchar *running = g_key_file_get_value (config_running, "general", keys[j], NULL);
+      gchar *loaded = g_key_file_get_value (key_file, "general", keys[j], NULL);
+
+      /* A key in both files is reported once, while going through the running one */
+      if (g_strcmp0 (running, loaded) != 0 && (i == 0 || !running))
+        g_printerr ("Setting %s of [general] changed from %s to %s, this needs a restart\n", keys[j],
+            running ? running : "(not set)", loaded ? loaded : "(not set)");
+      g_free (running);
+      g_free (loaded);
+    }
+    g_strfreev (keys);
+  }
+}
+
+/* SIGHUP handler: read the configuration again and restart the streams whose settings changed.
+ * Streams that did not change keep running untouched */
+static gboolean reload_cb (CustomData *data) {
+  GKeyFile *key_file;
+  GPtrArray *sites;
+  GError *error = NULL;
+  guint i, index;
+
+  g_print ("Reloading the configuration\n");
+  key_file = config_open (&error);
+  sites = key_file ? config_load_sites (key_file, &error) : NULL;
+  if (!sites) {
+    g_printerr ("Unable to reload the configuration, keeping the current one: %s\n", error->message);
+    g_clear_error (&error);
+    if (key_file)
+      g_key_file_free (key_file);
+    return TRUE;
+  }
+  config_check_general (key_file);
+  g_key_file_free (key_file);
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+    StreamSite *site = sites_find (sites, stream->site->name);
+
+    if (!site) {
+      g_printerr ("Stream %s was removed from the configuration, this needs a restart\n", stream->site->name);
+      continue;
+    }
+    if (site->row != stream->site->row || site->column != stream->site->column)
+      g_printerr ("Placement of stream %s changed, this needs a restart\n", site->name);
+    if (site->relay != stream->site->relay)
+      g_printerr ("Relaying of stream %s changed, this needs a restart\n", site->name);
+    g_ptr_array_find (sites, site, &index);
+    if (site_equal (site, stream->site)) {
+      g_ptr_array_remove_index (sites, index);
+      continue;
+    }
+    g_print ("Settings of stream %s changed, restarting it\n", site->name);
+    /* The stream takes the site over, its tile and its relay stay as they are until the next restart */
+    g_ptr_array_steal_index (sites, index);
+    site->row = stream->site->row;
+    site->column = stream->site->column;
+    site->relay = stream->site->relay;
+    stream_restart (stream, site);
+  }
+  for (i = 0; i < sites->len; i++) {
+    StreamSite *site = g_ptr_array_index (sites, i);
+
+    g_printerr ("Stream %s was added to the configuration, this needs a restart\n", site->name);
+  }
+  g_ptr_array_unref (sites);
+  return TRUE;
+}
+
+/* A request to save the end of the segment ring of a stream into a clip, see record_save */
+typedef struct _RecordSave {
+  gchar *name;                    /* Site of the stream */
+  guint seconds;                  /* Seconds before now the clip starts */
+} RecordSave;
+
+static void record_save_free (RecordSave *save) {
+  g_free (save->name);
+  g_free (save);
+}
+
+/* A segment of a ring and the time it was last written to */
+typedef struct _RecordSegment {
+  gchar *path;
+  gint64 mtime;
+} RecordSegment;
+
+static void record_segment_clear (RecordSegment *segment) {
+  g_free (segment->path);
+}
+
+static gint record_segment_compare (const RecordSegment *a, const RecordSegment *b) {
+  if (a->mtime != b->mtime)
+    return a->mtime < b->mtime ? -1 : 1;
+  return strcmp (a->path, b->path);
+}
+
+/* Runs on a worker thread of GTask, so neither the disk nor the size of the clip hold up a stream. Every segment written to
+ * during the last seconds is copied into the clip, oldest first. The segments start with the program tables and a keyframe
+ * each, so their concatenation is a valid MPEG-TS stream. The segment still being written is copied up to where the recorder is */
+static void record_save_thread (GTask *task, gpointer source, RecordSave *save, GCancellable *cancellable) {
+  gchar *directory = record_ring_directory (save->name);
+  GArray *segments = g_array_new (FALSE, FALSE, sizeof (RecordSegment));
+  GDateTime *now = g_date_time_new_now_local ();
+  GFileOutputStream *out = NULL;
+  GError *error = NULL;
+  gchar *path = NULL;
+  const gchar *entry;
+  GDir *dir;
+  guint i;
+
+  g_array_set_clear_func (segments, (GDestroyNotify) record_segment_clear);
+  dir = g_dir_open (directory, 0, &error);
+  while (dir && (entry = g_dir_read_name (dir))) {
+    RecordSegment segment;
+    GStatBuf st;
+
+    if (!g_str_has_prefix (entry, "segment") || !g_str_has_suffix (entry, ".ts"))
+      continue;
+    segment.path = g_build_filename (directory, entry, NULL);
+    if (g_stat (segment.path, &st) < 0 || st.st_mtime < g_date_time_to_unix (now) - (gint64) save->seconds) {
+      g_free (segment.path);
+      continue;
+    }
+    segment.mtime = st.st_mtime;
+    g_array_append_val (segments, segment);
+  }
+  if (dir)
+    g_dir_close (dir);
+  if (!error && !segments->len)
+    g_set_error (&error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "nothing was recorded during the last %u seconds", save->seconds);
+
+  if (!error) {
+    gchar *stamp = g_date_time_format (now, "%Y%m%d-%H%M%S");
+    gchar *name = g_strdup_printf ("%s-%s.ts", save->name, stamp);
+    GFile *file;
+
+    path = g_build_filename (record_directory, name, NULL);
+    g_free (name);
+    g_free (stamp);
+    file = g_file_new_for_path (path);
+    out = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, cancellable, &error);
+    g_object_unref (file);
+    g_array_sort (segments, (GCompareFunc) record_segment_compare);
+  }
+  for (i = 0; out && !error && i < segments->len; i++) {
+    GFile *file = g_file_new_for_path (g_array_index (segments, RecordSegment, i).path);
+    GFileInputStream *in = g_file_read (file, cancellable, &error);
+
+    if (in) {
+      g_output_stream_splice (G_OUTPUT_STREAM (out), G_INPUT_STREAM (in), G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE, cancellable, &error);
+      g_object_unref (in);
+    }
+    g_object_unref (file);
+  }
+  if (out) {
+    g_output_stream_close (G_OUTPUT_STREAM (out), cancellable, error ? NULL : &error);
+    g_object_unref (out);
+  }
+
+  g_array_unref (segments);
+  g_date_time_unref (now);
+  g_free (directory);
+  if (error) {
+    if (path)
+      g_unlink (path);
+    g_free (path);
+    g_task_return_error (task, error);
+    return;
+  }
+  g_task_return_pointer (task, path, g_free);
+}
+
+/* Save the last seconds of the recording of stream into a clip next to the rings, named after the site and the time.
+ * callback is called on the thread default context of the caller once the clip is written, record_save_finish
+ * returns its path */
+static void record_save (VideoStream *stream, guint seconds, GAsyncReadyCallback callback, gpointer user_data) {
+  RecordSave *save = g_new0 (RecordSave, 1);
+  GTask *task = g_task_new (NULL, NULL, callback, user_data);
+
+  save->name = g_strdup (stream->site->name);
+  save->seconds = seconds;
+  g_task_set_task_data (task, save, (GDestroyNotify) record_save_free);
+  g_task_run_in_thread (task, (GTaskThreadFunc) record_save_thread);
+  g_object_unref (task);
+}
+
+/* Path of the clip written by record_save, free with g_free. NULL with error set if it could not be written */
+static gchar *record_save_finish (GAsyncResult *result, GError **error) {
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void record_saved_cb (GObject *source, GAsyncResult *result, gchar *name) {
+  GError *error = NULL;
+  gchar *path = record_save_finish (result, &error);
+
+  if (path)
+    g_print ("Saved the recording of stream %s to %s\n", name, path);
+  else
+    g_printerr ("Unable to save the recording of stream %s: %s\n", name, error->message);
+  g_clear_error (&error);
+  g_free (path);
+  g_free (name);
+}
+
+/* Save the last record_save_length seconds of every recorded stream on SIGUSR1 */
+static gboolean record_signal_cb (CustomData *data) {
+  guint i, recorded = 0;
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    if (!stream->site->record)
+      continue;
+    record_save (stream, record_save_length, (GAsyncReadyCallback) record_saved_cb, g_strdup (stream->site->name));
+    recorded++;
+  }
+  if (!recorded)
+    g_printerr ("No stream is recorded, nothing to save\n");
+  return TRUE;
+}
+
+/* Find the encoder of the table called name */
+static CodecElement *encoder_find (const gchar *name) {
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (encoder_table); i++) {
+    if (g_strcmp0 (encoder_table[i].name, name) == 0)
+      return &encoder_table[i];
+  }
+  return NULL;
+}
+
+/* Create the media factory serving one capture device. With zero-copy v4l2src exports the captured frames as dmabufs
+ * and the encoder imports them. Encoders that cannot import them get the frames through videoconvert, which copies */
+static GstRTSPMediaFactory *mount_create_factory (ServerMount *mount) {
+  GstRTSPMediaFactory *factory;
+  GstRTSPLowerTrans protocols = 0;
+  CodecElement *encoder;
+  gchar *launch, *encoder_desc;
+  gboolean zero_copy;
+  guint i;
+
+  encoder = mount->encoder ? encoder_find (mount->encoder) : g_ptr_array_index (encoders, 0);
+  zero_copy = mount->zero_copy && encoder && encoder->dmabuf;
+  if (encoder)
+    encoder_desc = zero_copy ? g_strdup_printf ("%s %s", encoder->desc, encoder->dmabuf) : g_strdup (encoder->desc);
+  else
+    encoder_desc = g_strdup (mount->encoder);
+
+  /* make a media factory for the device. The default media factory can use
+   * gst-launch syntax to create pipelines.
+   * any launch line works as long as it contains elements named pay%d. Each
+   * element with pay%d names will be a stream */
+  factory = gst_rtsp_media_factory_new ();
+  launch = g_strdup_printf ("v4l2src device=\"%s\" io-mode=%s ! video/x-raw, width=%d, height=%d, framerate=%d/1 ! %s%s"
+      " ! video/x-h264, stream-format=byte-stream, alignment=au, profile=high ! h264parse ! rtph264pay name=pay0 pt=96 config-interval=-1",
+      mount->device, zero_copy ? "dmabuf" : "auto", mount->width, mount->height, mount->framerate,
+      zero_copy ? "" : "videoconvert ! ", encoder_desc);
+  gst_rtsp_media_factory_set_launch (factory, launch);
+  g_free (launch);
+  g_free (encoder_desc);
+
+  /* make rtsp-server available for multiple clients */
+  gst_rtsp_media_factory_set_shared (factory, TRUE);
+
+  /* Each client picks one of the transports offered */
+  for (i = 0; mount->protocols && mount->protocols[i]; i++) {
+    if (g_strcmp0 (mount->protocols[i], "udp") == 0)
+      protocols |= GST_RTSP_LOWER_TRANS_UDP;
+    else if (g_strcmp0 (mount->protocols[i], "tcp") == 0)
+      protocols |= GST_RTSP_LOWER_TRANS_TCP;
+    else if (g_strcmp0 (mount->protocols[i], "multicast") == 0)
+      protocols |= GST_RTSP_LOWER_TRANS_UDP_MCAST;
+    else
+      g_printerr ("Unknown protocol %s of mount %s\n", mount->protocols[i], mount->name);
+  }
+  if (protocols)
+    gst_rtsp_media_factory_set_protocols (factory, protocols);
+
+  /* Multicast clients get their group from the pool */
+  if (mount->multicast) {
+    GstRTSPAddressPool *pool = gst_rtsp_address_pool_new ();
+    gchar **range = g_strsplit (mount->multicast, "-", 2);
+
+    if (!gst_rtsp_address_pool_add_range (pool, range[0], range[1] ? range[1] : range[0],
+        mount->multicast_port_min, mount->multicast_port_max, mount->multicast_ttl))
+      g_printerr ("Invalid multicast range %s of mount %s\n", mount->multicast, mount->name);
+    gst_rtsp_media_factory_set_address_pool (factory, pool);
+    g_object_unref (pool);
+    g_strfreev (range);
+  }
+  g_print ("Mount %s serves %s%s\n", mount->path, mount->device, zero_copy ? " without copies" : "");
+  return factory;
+}
+
+static StreamRelay *relay_new (const gchar *name) {
+  StreamRelay *relay = g_rc_box_new0 (StreamRelay);
+  gchar *escaped = g_uri_escape_string (name, NULL, FALSE);
+
+  relay->path = g_strconcat (RELAY_PATH, escaped, NULL);
+  g_free (escaped);
+  g_mutex_init (&relay->lock);
+  return relay;
+}
+
+static void relay_clear (StreamRelay *relay) {
+  g_free (relay->path);
+  g_mutex_clear (&relay->lock);
+  if (relay->appsrc)
+    gst_object_unref (relay->appsrc);
+  if (relay->caps)
+    gst_caps_unref (relay->caps);
+}
+
+static void relay_unref (StreamRelay *relay) {
+  g_rc_box_release_full (relay, (GDestroyNotify) relay_clear);
+}
+
+/* The appsrc of the media of a relay mount */
+static GstElement *relay_media_get_appsrc (GstRTSPMedia *media) {
+  GstElement *element = gst_rtsp_media_get_element (media);
+  GstElement *appsrc = gst_bin_get_by_name (GST_BIN (element), "relaysrc");
+
+  gst_object_unref (element);
+  return appsrc;
+}
+
+/* The last client of a relay media is gone, the relay stops feeding it. Runs on the rtsp server thread */
+static void relay_media_unprepared_cb (GstRTSPMedia *media, StreamRelay *relay) {
+  GstElement *appsrc = relay_media_get_appsrc (media);
+
+  g_mutex_lock (&relay->lock);
+  if (relay->appsrc == appsrc)
+    gst_object_replace ((GstObject **) &relay->appsrc, NULL);
+  g_mutex_unlock (&relay->lock);
+  gst_object_unref (appsrc);
+}
+
+/* The first client of a relay mount created its media, the relay feeds it from now on. Runs on the rtsp server thread */
+static void relay_media_configure_cb (GstRTSPMediaFactory *factory, GstRTSPMedia *media, StreamRelay *relay) {
+  GstElement *appsrc = relay_media_get_appsrc (media);
+
+  g_mutex_lock (&relay->lock);
+  gst_object_replace ((GstObject **) &relay->appsrc, GST_OBJECT (appsrc));
+  gst_caps_replace (&relay->caps, NULL);
+  relay->keyframe = TRUE;
+  g_mutex_unlock (&relay->lock);
+  gst_object_unref (appsrc);
+  g_signal_connect_data (media, "unprepared", G_CALLBACK (relay_media_unprepared_cb), g_rc_box_acquire (relay),
+      (GClosureNotify) relay_unref, 0);
+}
+
+/* Create the media factory of the relay of a stream. Its appsrc is fed by relay_new_sample_cb and the H.264 is only
+ * payloaded again, rtph264pay hands every frame to the sinks as one buffer list. The factory is shared, so all clients
+ * are served from the one connection of the stream to its camera */
+static GstRTSPMediaFactory *relay_create_factory (StreamRelay *relay) {
+  GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new ();
+
+  gst_rtsp_media_factory_set_launch (factory, "appsrc name=relaysrc is-live=true do-timestamp=true format=time"
+      " ! h264parse ! rtph264pay name=pay0 pt=96 config-interval=-1");
+  gst_rtsp_media_factory_set_shared (factory, TRUE);
+  g_signal_connect_data (factory, "media-configure", G_CALLBACK (relay_media_configure_cb), g_rc_box_acquire (relay),
+      (GClosureNotify) relay_unref, 0);
+  return factory;
+}
+
+/* Serve the relay of stream on the running rtsp server */
+static void relay_mount (CustomData *data, VideoStream *stream) {
+  GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points (data->server);
+
+  gst_rtsp_mount_points_add_factory (mounts, stream->relay->path, relay_create_factory (stream->relay));
+  g_object_unref (mounts);
+  g_print ("Stream %s is relayed at rtsp://%s:%s%s\n", stream->site->name, server_address, port, stream->relay->path);
+}
+
+/* Take the relay of stream off the rtsp server. Clients still watching get the end of the stream */
+static void relay_unmount (CustomData *data, VideoStream *stream) {
+  StreamRelay *relay = stream->relay;
+
+  if (data->server) {
+    GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points (data->server);
+
+    gst_rtsp_mount_points_remove_factory (mounts, relay->path);
+    g_object_unref (mounts);
+  }
+  g_mutex_lock (&relay->lock);
+  if (relay->appsrc) {
+    gst_app_src_end_of_stream (GST_APP_SRC (relay->appsrc));
+    gst_object_replace ((GstObject **) &relay->appsrc, NULL);
+  }
+  g_mutex_unlock (&relay->lock);
+}
+
+/* The rtsp server side runs its own main loop on this thread, so that serving the clients never waits for GTK */
+static gpointer rtsp_server_thread (GMainLoop *loop) {
+  g_main_loop_run (loop);
+  return NULL;
+}
+
+/* Startup of the rtsp server side, serving every mount and the relays of the streams. It is attached to a main context
+ * of its own that rtsp_server_thread runs. server_mounts is NULL on a node that only relays */
+static gboolean rtsp_server (CustomData *data, GPtrArray *server_mounts)
+{
+  GMainContext *context;
+  GstRTSPMountPoints *mounts;
+  guint i;
+
+  /* Mounts without an encoder of their own use the fastest one that works on this machine */
+  if (server_mounts && server_mounts->len && !encoders && !encoders_probe ())
+    return FALSE;
+
+  /* create a server instance */
+  data->server = gst_rtsp_server_new ();
+  gst_rtsp_server_set_address(data->server, server_address);
+  g_object_set (data->server, "service", port, NULL);
+
+  /* get the mount points for this server, every server has a default object
+   * that be used to map uri mount points to media factories */
+  mounts = gst_rtsp_server_get_mount_points (data->server);
+  for (i = 0; server_mounts && i < server_mounts->len; i++) {
+    ServerMount *mount = g_ptr_array_index (server_mounts, i);
+
+    gst_rtsp_mount_points_add_factory (mounts, mount->path, mount_create_factory (mount));
+  }
+
+  /* don't need the ref to the mapper anymore */
+  g_object_unref (mounts);
+
+  /* attach the server to its own main context */
+  context = g_main_context_new ();
+  if (gst_rtsp_server_attach (data->server, context) == 0) {
+    g_printerr ("Unable to start the rtsp server on %s:%s\n", server_address, port);
+    g_main_context_unref (context);
+    g_object_unref (data->server);
+    data->server = NULL;
+    return FALSE;
+  }
+  data->serverLoop = g_main_loop_new (context, FALSE);
+  g_main_context_unref (context);
+  data->serverThread = g_thread_new ("rtsp-server", (GThreadFunc) rtsp_server_thread, data->serverLoop);
+
+  /* start serving */
+  g_print ("rtsp server ready at rtsp://%s:%s\n", server_address, port);
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    if (stream->relay)
+      relay_mount (data, stream);
+  }
+  return TRUE;
+}
+
+/* Stop the rtsp server side and wait for its thread */
+static void rtsp_server_stop (CustomData *data) {
+  if (!data->server)
+    return;
+  g_main_loop_quit (data->serverLoop);
+  g_thread_join (data->serverThread);
+  g_main_loop_unref (data->serverLoop);
+  g_object_unref (data->server);
+  data->server = NULL;
+}
+
+/* Append the elements of one tile to a pipeline description: the live branch and the waiting video branch, both
+ * appsrcs fed from other pipelines, joined by an input-selector whose output goes to downstream. Inactive
+ * branches do not wait for the active one (sync-streams=false), their frames are simply dropped */
+static void tile_append_desc (GString *pipe_desc, guint index, const gchar *downstream) {
+  g_string_append_printf (pipe_desc, " input-selector name=sel%u sync-streams=false ! %s"
+      " appsrc name=live%u is-live=true do-timestamp=true format=time ! queue max-size-buffers=2 leaky=downstream ! sel%u.sink_0"
+      " appsrc name=wait%u is-live=true do-timestamp=true format=time ! queue max-size-buffers=2 leaky=downstream ! sel%u.sink_1",
+      index, downstream, index, index, index, index);
+}
+
+/* Look up the elements of the tile of the stream in the pipeline holding it, the tile starts on the waiting video */
+static void stream_bind_tile (VideoStream *stream, GstElement *pipeline) {
+  GstElement *selector;
+  gchar *name;
+
+  name = g_strdup_printf ("sel%u", stream->index);
+  selector = gst_bin_get_by_name (GST_BIN (pipeline), name);
+  g_free (name);
+  stream->livePad = gst_element_get_static_pad (selector, "sink_0");
+  stream->waitPad = gst_element_get_static_pad (selector, "sink_1");
+  name = g_strdup_printf ("wait%u", stream->index);
+  stream->waitSrc = gst_bin_get_by_name (GST_BIN (pipeline), name);
+  g_free (name);
+
+  /* The live stream connects while the tiles are still being built and may be shown already */
+  g_mutex_lock (&stream->liveLock);
+  name = g_strdup_printf ("live%u", stream->index);
+  stream->liveSrc = gst_bin_get_by_name (GST_BIN (pipeline), name);
+  g_free (name);
+  g_object_set (selector, "active-pad", g_atomic_int_get (&stream->showLive) ? stream->livePad : stream->waitPad, NULL);
+  g_atomic_pointer_set (&stream->selector, selector);
+  g_mutex_unlock (&stream->liveLock);
+}
+
+/* Errors of the pipelines no other handler looks at: the waiting video and the display pipelines of the tiles.
+ * They are only logged, the tiles keep what they show */
+static void pipeline_error_cb (GstBus *bus, GstMessage *msg, const gchar *name) {
+  GError *err;
+  gchar *debug_info;
+
+  gst_message_parse_error (msg, &err, &debug_info);
+  g_printerr ("Error received from element %s of %s: %s\n", GST_OBJECT_NAME (msg->src), name, err->message);
+  g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+  g_clear_error (&err);
+  g_free (debug_info);
+}
+
+/* Watch the bus of pipeline, so that its messages do not pile up unread, and log its errors as those of name */
+static void pipeline_watch_errors (GstElement *pipeline, const gchar *name) {
+  GstBus *bus = gst_element_get_bus (pipeline);
+
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect_data (bus, "message::error", G_CALLBACK (pipeline_error_cb), g_strdup (name), (GClosureNotify) g_free, 0);
+  gst_object_unref (bus);
+}
+
+/* Remove the watch of pipeline_watch_errors before the pipeline is freed */
+static void pipeline_unwatch_errors (GstElement *pipeline) {
+  GstBus *bus = gst_element_get_bus (pipeline);
+
+  gst_bus_remove_signal_watch (bus);
+  g_signal_handlers_disconnect_by_func (bus, pipeline_error_cb, NULL);
+  gst_object_unref (bus);
+}
+
+/* Create the pipeline rendering the tile of one stream on its own window (window mode only) */
+static gboolean stream_create_display (VideoStream *stream) {
+  GString *pipe_desc;
+  GError *error=NULL;
+  GstBus *bus;
+  gchar *name;
+
+  pipe_desc = g_string_new (NULL);
+  tile_append_desc (pipe_desc, stream->index, "glimagesink sync=false async=false");
+  stream->display = gst_parse_launch (pipe_desc->str, &error);
+  g_string_free (pipe_desc, TRUE);
+  if (!stream->display) {
+    g_printerr ("Unable to create the display pipeline of stream %s: %s\n", stream->site->name, error->message);
+    g_clear_error (&error);
+    return FALSE;
+  }
+  g_clear_error (&error);
+  stream_bind_tile (stream, stream->display);
+
+  /* Instruct the bus to hand the window handle to the sink of the tile */
+  bus = gst_element_get_bus (stream->display);
+  gst_bus_set_sync_handler (bus, (GstBusSyncHandler) bus_sync_handler, &stream->window_handle, NULL);
+  gst_object_unref (bus);
+  name = g_strdup_printf ("the display of stream %s", stream->site->name);
+  pipeline_watch_errors (stream->display, name);
+  g_free (name);
+  return TRUE;
+}
+
+/* The crop settings of the waiting video are in pixels of the clip. They are scaled to the size the scaler negotiated
+ * whenever it changes, before videocrop gets the new caps */
+static GstPadProbeReturn placeholder_crop_probe_cb (GstPad *pad, GstPadProbeInfo *info, GstElement *pipeline) {
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstElement *element;
+  GstCaps *caps, *clip_caps;
+  gint width = 0, height = 0, clip_width, clip_height;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+  gst_event_parse_caps (event, &caps);
+  gst_structure_get_int (gst_caps_get_structure (caps, 0), "width", &width);
+  gst_structure_get_int (gst_caps_get_structure (caps, 0), "height", &height);
+  clip_width = width;
+  clip_height = height;
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "dec");
+  pad = gst_element_get_static_pad (element, "src");
+  clip_caps = gst_pad_get_current_caps (pad);
+  if (clip_caps) {
+    gst_structure_get_int (gst_caps_get_structure (clip_caps, 0), "width", &clip_width);
+    gst_structure_get_int (gst_caps_get_structure (clip_caps, 0), "height", &clip_height);
+    gst_caps_unref (clip_caps);
+  }
+  gst_object_unref (pad);
+  gst_object_unref (element);
+  if (width <= 0 || height <= 0 || clip_width <= 0 || clip_height <= 0)
+    return GST_PAD_PROBE_OK;
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "crop");
+  g_object_set (element, "right", (gint) gst_util_uint64_scale_int_round (placeholder_crop_right, width, clip_width),
+      "bottom", (gint) gst_util_uint64_scale_int_round (placeholder_crop_bottom, height, clip_height), NULL);
+  gst_object_unref (element);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Create the snow pipeline decoding the waiting video for all tiles. This is the only decoder instance spent on the
+ * waiting video, however many tiles there are. The clip has no timestamps of its own, they are derived from
+ * PLACEHOLDER_FRAMERATE so that the appsink plays it in real time instead of as fast as it decodes */
+static gboolean placeholder_create (CustomData *data) {
+  GstElement *src;
+  GstPad *pad;
+  gchar *pipe_desc, *scale;
+  GError *error=NULL;
+
+  /* Cropping comes after scaling, so it copies the smaller frames */
+  scale = scaler_desc ();
+  pipe_desc= g_strdup_printf ("multifilesrc name=src loop=true caps=\"video/x-h264, stream-format=byte-stream, framerate=%d/1\" ! h264parse ! %s name=dec ! %svideocrop name=crop ! appsink name=out max-buffers=1 drop=true",
+      PLACEHOLDER_FRAMERATE, placeholder_decoder ? placeholder_decoder : ((CodecElement *) g_ptr_array_index (decoders, 0))->desc, scale);
+  data->placeholder=gst_parse_launch(pipe_desc, &error);
+  g_free(pipe_desc);
+  g_free (scale);
+  if (!data->placeholder) {
+    g_printerr ("Unable to create the waiting video pipeline: %s\n", error->message);
+    g_clear_error (&error);
+    return FALSE;
+  }
+  g_clear_error (&error);
+  src = gst_bin_get_by_name (GST_BIN (data->placeholder), "src");
+  g_object_set (src, "location", placeholder_location, NULL);
+  gst_object_unref (src);
+  src = gst_bin_get_by_name (GST_BIN (data->placeholder), "crop");
+  pad = gst_element_get_static_pad (src, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback) placeholder_crop_probe_cb, data->placeholder, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (src);
+  appsink_connect (data->placeholder, "out", placeholder_new_sample_cb, data);
+  pipeline_watch_errors (data->placeholder, "the waiting video");
+  return TRUE;
+}
+
+/* This function is called when the compositor pipeline changes states, we only track its own state for wall_draw_cb */
+static void compositor_state_changed_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+  GstState old_state, new_state, pending_state;
+
+  gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
+  if (GST_MESSAGE_SRC (msg) == GST_OBJECT (data->compositor))
+    data->stateCompositor = new_state;
+}
+
+/* This function is called when an error message is posted on the bus of the compositor pipeline */
+static void compositor_error_cb (GstBus *bus, GstMessage *msg, CustomData *data) {
+  GError *err;
+  gchar *debug_info;
+
+  gst_message_parse_error (msg, &err, &debug_info);
+  g_printerr ("Error received from element %s of the compositor: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+  g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+  g_clear_error (&err);
+  g_free (debug_info);
+}
+
+/* Add the tile of stream to the compositor pipeline, as a bin of its own on a new mixer pad placed on its cell of the grid.
+ * Tiles can be added to the playing pipeline, the bin takes over its state */
+static gboolean compositor_add_tile (CustomData *data, VideoStream *stream) {
+  guint width = WALL_WIDTH / data->columns, height = WALL_HEIGHT / data->rows;
+  GString *pipe_desc;
+  GstElement *mix;
+  GError *error=NULL;
+  GstPad *pad;
+
+  pipe_desc = g_string_new (NULL);
+  tile_append_desc (pipe_desc, stream->index, "queue max-size-buffers=2 leaky=downstream");
+  stream->tile = gst_parse_bin_from_description (pipe_desc->str, TRUE, &error);
+  g_string_free (pipe_desc, TRUE);
+  if (!stream->tile) {
+    g_printerr ("Unable to create the tile of stream %s: %s\n", stream->site->name, error->message);
+    g_clear_error (&error);
+    return FALSE;
+  }
+  g_clear_error (&error);
+  gst_object_ref_sink (stream->tile);
+  gst_bin_add (GST_BIN (data->compositor), stream->tile);
+
+  mix = gst_bin_get_by_name (GST_BIN (data->compositor), "mix");
+  stream->mixerPad = gst_element_get_request_pad (mix, "sink_%u");
+  g_object_set (stream->mixerPad, "xpos", stream->column * width, "ypos", stream->row * height,
+      "width", width, "height", height, NULL);
+  pad = gst_element_get_static_pad (stream->tile, "src");
+  gst_pad_link (pad, stream->mixerPad);
+  gst_object_unref (pad);
+  gst_object_unref (mix);
+
+  stream_bind_tile (stream, data->compositor);
+  gst_element_sync_state_with_parent (stream->tile);
+  return TRUE;
+}
+
+/* Take the tile of stream out of the compositor pipeline */
+static void compositor_remove_tile (CustomData *data, VideoStream *stream) {
+  GstElement *mix = gst_bin_get_by_name (GST_BIN (data->compositor), "mix");
+
+  gst_element_set_state (stream->tile, GST_STATE_NULL);
+  gst_element_release_request_pad (mix, stream->mixerPad);
+  gst_object_unref (stream->mixerPad);
+  stream->mixerPad = NULL;
+  gst_bin_remove (GST_BIN (data->compositor), stream->tile);
+  gst_object_unref (stream->tile);
+  stream->tile = NULL;
+  gst_object_unref (mix);
+}
+
+/* Create the pipeline that mixes all tiles into one picture and renders it on the single video window.
+ * Every tile's input-selector feeds a mixer pad, placed on the same grid create_ui uses for the tile windows */
+static gboolean compositor_create (CustomData *data) {
+  const gchar *mixer = mixer_element ? mixer_element : "glvideomixer";
+  gchar *pipe_desc;
+  GError *error=NULL;
+  GstBus *bus;
+  guint i;
+
+  layout_assign (data, &data->columns, &data->rows);
+
+  /* glvideomixer keeps the mixed picture in GL memory all the way to glimagesink */
+  pipe_desc = g_strdup_printf ("%s name=mix background=black ! video/x-raw%s, width=%d, height=%d ! glimagesink sync=false async=false",
+      mixer, g_str_has_prefix (mixer, "gl") ? "(memory:GLMemory)" : "", WALL_WIDTH, WALL_HEIGHT);
+  data->compositor = gst_parse_launch (pipe_desc, &error);
+  g_free (pipe_desc);
+  if (!data->compositor) {
+    g_printerr ("Unable to create the compositor pipeline: %s\n", error->message);
+    g_clear_error (&error);
+    return FALSE;
+  }
+  g_clear_error (&error);
+
+  for (i = 0; i < data->streams->len && compositor_add_tile (data, g_ptr_array_index (data->streams, i)); i++);
+  if (i < data->streams->len) {
+    while (i--)
+      compositor_remove_tile (data, g_ptr_array_index (data->streams, i));
+    gst_object_unref (data->compositor);
+    data->compositor = NULL;
+    return FALSE;
+  }
+
+  bus = gst_element_get_bus (data->compositor);
+  gst_bus_set_sync_handler (bus, (GstBusSyncHandler) bus_sync_handler, &data->window_handle, NULL);
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (G_OBJECT (bus), "message::error", (GCallback)compositor_error_cb, data);
+  g_signal_connect (G_OBJECT (bus), "message::state-changed", (GCallback)compositor_state_changed_cb, data);
+  gst_object_unref (bus);
+  return TRUE;
+}
+
+/* Once a second: the frame rate each stream decoded during the last second */
+static gboolean metrics_update_cb (CustomData *data) {
+  guint i;
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+    guint64 decoded = METRIC_GET (stream->metrics.decoded);
+
+    METRIC_SET (stream->metrics.fps, decoded - stream->metrics.decoded_before);
+    stream->metrics.decoded_before = decoded;
+  }
+  return TRUE;
+}
+
+/* Append one metric family with the value of every stream. offset is the one of a StreamMetrics field */
+static void metrics_append (GString *out, CustomData *data, const gchar *name, const gchar *type, const gchar *help, gsize offset) {
+  guint i;
+
+  g_string_append_printf (out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+    guint64 *value = G_STRUCT_MEMBER_P (&stream->metrics, offset);
+
+    g_string_append_printf (out, "%s{stream=\"%s\"} %" G_GUINT64_FORMAT "\n", name, stream->site->name, METRIC_GET (*value));
+  }
+}
+
+/* Append the latency histogram of every stream in seconds, as Prometheus expects it */
+static void metrics_append_latency (GString *out, CustomData *data) {
+  const gchar *name = "virtualwindow_glass_to_glass_latency_seconds";
+  guint i, j;
+
+  g_string_append_printf (out, "# HELP %s Time from capture at the sender to the frame reaching the display side\n# TYPE %s histogram\n", name, name);
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+    guint64 cumulative = 0;
+
+    for (j = 0; j < G_N_ELEMENTS (latency_buckets); j++) {
+      cumulative += METRIC_GET (stream->metrics.latency_bucket[j]);
+      g_string_append_printf (out, "%s_bucket{stream=\"%s\",le=\"%g\"} %" G_GUINT64_FORMAT "\n",
+          name, stream->site->name, latency_buckets[j] / 1000.0, cumulative);
+    }
+    g_string_append_printf (out, "%s_bucket{stream=\"%s\",le=\"+Inf\"} %" G_GUINT64_FORMAT "\n",
+        name, stream->site->name, METRIC_GET (stream->metrics.latency_count));
+    g_string_append_printf (out, "%s_sum{stream=\"%s\"} %g\n", name, stream->site->name,
+        METRIC_GET (stream->metrics.latency_sum) / (gdouble) G_USEC_PER_SEC);
+    g_string_append_printf (out, "%s_count{stream=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        name, stream->site->name, METRIC_GET (stream->metrics.latency_count));
+  }
+}
+
+/* The metrics of all streams in the Prometheus text format */
+static gchar *metrics_format (CustomData *data) {
+  GString *out = g_string_new (NULL);
+  guint64 age_min = G_MAXUINT64, age_max = 0;
+  guint i;
+
+  metrics_append (out, data, "virtualwindow_rtp_packets_total", "counter", "RTP packets out of the jitterbuffer", G_STRUCT_OFFSET (StreamMetrics, packets));
+  metrics_append (out, data, "virtualwindow_rtp_bytes_total", "counter", "RTP bytes out of the jitterbuffer", G_STRUCT_OFFSET (StreamMetrics, bytes));
+  metrics_append (out, data, "virtualwindow_frames_received_total", "counter", "Frames out of the depayloader", G_STRUCT_OFFSET (StreamMetrics, received));
+  metrics_append (out, data, "virtualwindow_frames_decoded_total", "counter", "Frames out of the decoder", G_STRUCT_OFFSET (StreamMetrics, decoded));
+  metrics_append (out, data, "virtualwindow_frames_shown_total", "counter", "Frames handed to the tile, the rest was dropped as late", G_STRUCT_OFFSET (StreamMetrics, shown));
+  metrics_append (out, data, "virtualwindow_decoded_fps", "gauge", "Frames decoded during the last second", G_STRUCT_OFFSET (StreamMetrics, fps));
+  metrics_append (out, data, "virtualwindow_reconnects_total", "counter", "Reconnects of the live stream", G_STRUCT_OFFSET (StreamMetrics, reconnects));
+  metrics_append (out, data, "virtualwindow_glass_to_glass_latency_last_microseconds", "gauge", "Latency of the last frame measured", G_STRUCT_OFFSET (StreamMetrics, latency_last));
+  metrics_append (out, data, "virtualwindow_jitterbuffer_fill_percent", "gauge", "Fill level of the jitterbuffer", G_STRUCT_OFFSET (StreamMetrics, jitterbuffer_percent));
+  metrics_append (out, data, "virtualwindow_packets_lost_total", "counter", "RTP packets the jitterbuffer gave up on", G_STRUCT_OFFSET (StreamMetrics, lost));
+  metrics_append (out, data, "virtualwindow_jitterbuffer_latency_milliseconds", "gauge", "Jitterbuffer latency set by the adaptive latency controller", G_STRUCT_OFFSET (StreamMetrics, latency));
+  metrics_append (out, data, "virtualwindow_time_to_first_frame_microseconds", "gauge", "Time from the last connect to its first decoded frame", G_STRUCT_OFFSET (StreamMetrics, first_frame));
+  metrics_append (out, data, "virtualwindow_packets_late_total", "counter", "RTP packets that arrived after their latency", G_STRUCT_OFFSET (StreamMetrics, late));
+  metrics_append (out, data, "virtualwindow_stalls_total", "counter", "Stalls of the live stream without an error, each followed by a reconnect", G_STRUCT_OFFSET (StreamMetrics, stalls));
+  metrics_append (out, data, "virtualwindow_stall_microseconds_total", "counter", "Time the live stream was stalled, from its last frame to the first one after it", G_STRUCT_OFFSET (StreamMetrics, stall_time));
+  metrics_append (out, data, "virtualwindow_stall_last_microseconds", "gauge", "Duration of the last stall that ended", G_STRUCT_OFFSET (StreamMetrics, stall_last));
+  metrics_append (out, data, "virtualwindow_frame_age_microseconds", "gauge", "Time from the capture of the last frame handed to the tile until then", G_STRUCT_OFFSET (StreamMetrics, age));
+  metrics_append_latency (out, data);
+
+  g_string_append (out, "# HELP virtualwindow_live Whether the tile shows the live stream\n# TYPE virtualwindow_live gauge\n");
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    g_string_append_printf (out, "virtualwindow_live{stream=\"%s\"} %d\n", stream->site->name, g_atomic_int_get (&stream->showLive));
+  }
+
+  /* How far apart in capture time the tiles showing their live stream are, from the age of their last frames */
+  g_string_append (out, "# HELP virtualwindow_tile_skew_microseconds Spread of the frame ages of the tiles showing their live stream\n"
+      "# TYPE virtualwindow_tile_skew_microseconds gauge\n");
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+    guint64 age = METRIC_GET (stream->metrics.age);
+
+    if (!g_atomic_int_get (&stream->showLive) || !age)
+      continue;
+    age_min = MIN (age_min, age);
+    age_max = MAX (age_max, age);
+  }
+  g_string_append_printf (out, "virtualwindow_tile_skew_microseconds %" G_GUINT64_FORMAT "\n", age_max >= age_min ? age_max - age_min : 0);
+  return g_string_free (out, FALSE);
+}
+
+/* One connection to the metrics endpoint */
+typedef struct _MetricsRequest {
+  GSocketConnection *connection;
+  CustomData *data;
+  gchar buffer[METRICS_REQUEST_SIZE];
+  gchar *response;                /* Header and body of the answer while it is being sent */
+} MetricsRequest;
+
+static void metrics_request_free (MetricsRequest *request) {
+  g_io_stream_close (G_IO_STREAM (request->connection), NULL, NULL);
+  g_object_unref (request->connection);
+  g_free (request->response);
+  g_free (request);
+}
+
+/* The answer is out, or the client went away before it was */
+static void metrics_written_cb (GOutputStream *output, GAsyncResult *result, MetricsRequest *request) {
+  GError *error = NULL;
+
+  if (!g_output_stream_write_all_finish (output, result, NULL, &error)) {
+    g_printerr ("Unable to send the metrics: %s\n", error->message);
+    g_clear_error (&error);
+  }
+  metrics_request_free (request);
+}
+
+/* The request was read: whatever was asked for, answer with the metrics and close the connection. The answer is sent
+ * without blocking the main loop, a scraper that does not read holds up nothing but its own connection */
+static void metrics_read_cb (GInputStream *input, GAsyncResult *result, MetricsRequest *request) {
+  GOutputStream *output;
+  GError *error = NULL;
+  gchar *body;
+
+  if (g_input_stream_read_finish (input, result, &error) < 0) {
+    g_clear_error (&error);
+    metrics_request_free (request);
+    return;
+  }
+  body = metrics_format (request->data);
+  request->response = g_strdup_printf ("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %" G_GSIZE_FORMAT "\r\n"
+      "Connection: close\r\n\r\n%s", strlen (body), body);
+  g_free (body);
+  output = g_io_stream_get_output_stream (G_IO_STREAM (request->connection));
+  g_output_stream_write_all_async (output, request->response, strlen (request->response), G_PRIORITY_DEFAULT, NULL,
+      (GAsyncReadyCallback) metrics_written_cb, request);
+}
+
+/* A client connected to the metrics endpoint, read its request without blocking the main loop */
+static gboolean metrics_incoming_cb (GSocketService *service, GSocketConnection *connection, GObject *source, CustomData *data) {
+  MetricsRequest *request = g_new0 (MetricsRequest, 1);
+
+  request->connection = g_object_ref (connection);
+  request->data = data;
+  g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (connection)), request->buffer, sizeof (request->buffer),
+      G_PRIORITY_DEFAULT, NULL, (GAsyncReadyCallback) metrics_read_cb, request);
+  return TRUE;
+}
+
+/* Listen for metrics requests on address, which is released */
+static gboolean metrics_listen (CustomData *data, GSocketAddress *address, GError **error) {
+  gboolean ok;
+
+  ok = g_socket_listener_add_address (G_SOCKET_LISTENER (data->metrics), address, G_SOCKET_TYPE_STREAM,
+      G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, error);
+  g_object_unref (address);
+  return ok;
+}
+
+/* Serve the metrics over HTTP on the loopback interface and/or a Unix socket */
+static gboolean metrics_start (CustomData *data) {
+  GInetAddress *loopback;
+  GError *error = NULL;
+  gboolean ok = TRUE;
+
+  if (metrics_port <= 0 && !metrics_socket)
+    return TRUE;
+  data->metrics = g_socket_service_new ();
+
+  if (metrics_port > 0) {
+    loopback = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+    ok = metrics_listen (data, g_inet_socket_address_new (loopback, metrics_port), &error);
+    g_object_unref (loopback);
+    if (ok)
+      g_print ("Metrics served at http://127.0.0.1:%d/metrics\n", metrics_port);
+  }
+  if (ok && metrics_socket) {
+    /* A socket left behind by an earlier run would make the bind fail */
+    g_unlink (metrics_socket);
+    ok = metrics_listen (data, g_unix_socket_address_new (metrics_socket), &error);
+    if (ok)
+      g_print ("Metrics served on %s\n", metrics_socket);
+  }
+  if (!ok) {
+    g_printerr ("Unable to serve the metrics: %s\n", error->message);
+    g_clear_error (&error);
+    g_object_unref (data->metrics);
+    data->metrics = NULL;
+    return FALSE;
+  }
+
+  g_signal_connect (data->metrics, "incoming", G_CALLBACK (metrics_incoming_cb), data);
+  g_socket_service_start (data->metrics);
+  data->metrics_update = g_timeout_add_seconds (1, (GSourceFunc) metrics_update_cb, data);
+  return TRUE;
+}
+
+static void metrics_stop (CustomData *data) {
+  if (!data->metrics)
+    return;
+  g_source_remove (data->metrics_update);
+  g_socket_service_stop (data->metrics);
+  g_socket_listener_close (G_SOCKET_LISTENER (data->metrics));
+  g_object_unref (data->metrics);
+  data->metrics = NULL;
+  if (metrics_socket)
+    g_unlink (metrics_socket);
+}
+
+/* Control thread of a stream. Its context is the thread default, so the bus watches of the pipelines created here
+ * are dispatched here as well */
+static gpointer stream_thread (VideoStream *stream) {
+  g_main_context_push_thread_default (stream->context);
+  g_main_loop_run (stream->loop);
+  g_main_context_pop_thread_default (stream->context);
+  return NULL;
+}
+
+/* Add a stream to the video wall. The placeholder pipeline feeds the waiting video of every stream of the list, a
+ * stream added while it plays has to have its tile bound already */
+static void streams_append (CustomData *data, VideoStream *stream) {
+  g_mutex_lock (&data->streamsLock);
+  g_ptr_array_add (data->streams, stream);
+  g_mutex_unlock (&data->streamsLock);
+}
+
+/* Create the stream of a site, with its control thread. The stream takes the site over, see streams_append */
+static VideoStream *stream_new (CustomData *data, StreamSite *site) {
+  VideoStream *stream = g_new0 (VideoStream, 1);
+  gchar *name;
+
+  stream->index = data->tiles++;
+  stream->site = site;
+  stream->app = data;
+  stream->reconnect_delay = RECONNECT_DELAY_MIN;
+  stream->decoder_rank = site->decoder ? -1 : 0;
+  stream->latency = site->latency;
+  METRIC_SET (stream->metrics.latency, site->latency);
+  g_mutex_init (&stream->liveLock);
+  if (site->relay)
+    stream->relay = relay_new (site->name);
+
+  stream->context = g_main_context_new ();
+  stream->loop = g_main_loop_new (stream->context, FALSE);
+  stream->statsSource = stream_timeout_add (stream, 1000, (GSourceFunc) stream_stats_cb, stream);
+  if (stall_timeout > 0)
+    stream->stallSource = stream_timeout_add (stream, STALL_CHECK_INTERVAL, (GSourceFunc) stream_stall_check_cb, stream);
+  name = g_strdup_printf ("stream-%u", stream->index);
+  stream->thread = g_thread_new (name, (GThreadFunc) stream_thread, stream);
+  g_free (name);
+  return stream;
+}
+
+/* Last call on the control thread of a stream: its sources are dropped and its pipelines go to NULL on the thread their
+ * bus watches and reconnects run on, then the thread ends */
+static gboolean stream_teardown_cb (VideoStream *stream) {
+  stream_cancel_reconnect (stream);
+  g_source_destroy (stream->statsSource);
+  g_source_unref (stream->statsSource);
+  if (stream->stallSource) {
+    g_source_destroy (stream->stallSource);
+    g_source_unref (stream->stallSource);
+  }
+  stream_dispose_pipeline (stream, &stream->videoStream);
+  stream_dispose_pipeline (stream, &stream->standbyStream);
+  g_main_loop_quit (stream->loop);
+  return G_SOURCE_REMOVE;
+}
+
+/* Free all resources of one stream. Its control thread is stopped first, then nothing else touches its pipelines */
+static void stream_free (VideoStream *stream) {
+  stream_invoke (stream, (GSourceFunc) stream_teardown_cb, stream, NULL);
+  g_thread_join (stream->thread);
+  g_main_loop_unref (stream->loop);
+  g_main_context_unref (stream->context);
+  if (stream->display) {
+    gst_element_set_state (stream->display, GST_STATE_NULL);
+    pipeline_unwatch_errors (stream->display);
+    gst_object_unref (stream->display);
+  }
+  if (stream->tile)
+    compositor_remove_tile (stream->app, stream);
+  if (stream->selector)
+    gst_object_unref (stream->selector);
+  if (stream->livePad)
+    gst_object_unref (stream->livePad);
+  if (stream->waitPad)
+    gst_object_unref (stream->waitPad);
+  if (stream->liveSrc)
+    gst_object_unref (stream->liveSrc);
+  if (stream->liveCaps)
+    gst_caps_unref (stream->liveCaps);
+  if (stream->waitSrc)
+    gst_object_unref (stream->waitSrc);
+  if (stream->waitCaps)
+    gst_caps_unref (stream->waitCaps);
+  if (stream->latencies)
+    g_array_unref (stream->latencies);
+  if (stream->relay) {
+    relay_unmount (stream->app, stream);
+    relay_unref (stream->relay);
+  }
+  g_mutex_clear (&stream->liveLock);
+  site_free (stream->site);
+  g_free (stream);
+}
+
+/* Find a free cell of the grid for a tile added at runtime. In window mode the grid grows by a row when it is full,
+ * the compositor renders a grid of fixed size. Returns FALSE if there is no cell left */
+static gboolean layout_free_cell (CustomData *data, guint *row, guint *column) {
+  guint cell;
+
+  data->columns = MAX (data->columns, 1);
+  for (cell = 0; cell < data->columns * data->rows; cell++) {
+    if (!layout_taken (data, cell / data->columns, cell % data->columns)) {
+      *row = cell / data->columns;
+      *column = cell % data->columns;
+      return TRUE;
+    }
+  }
+  if (use_compositor)
+    return FALSE;
+  *row = data->rows++;
+  *column = 0;
+  return TRUE;
+}
+
+/* Take a stream off the running video wall and free it */
+static void stream_remove (CustomData *data, VideoStream *stream) {
+  guint index;
+
+  g_mutex_lock (&data->streamsLock);
+  if (g_ptr_array_find (data->streams, stream, &index))
+    g_ptr_array_steal_index (data->streams, index);
+  g_mutex_unlock (&data->streamsLock);
+  g_print ("Removing stream %s\n", stream->site->name);
+  if (stream->display)
+    gst_element_set_state (stream->display, GST_STATE_NULL);
+  if (stream->widget)
+    gtk_widget_destroy (stream->widget);
+  stream_free (stream);
+  placeholder_resize (data);
+}
+
+/* Add a stream for site to the running video wall, on a free cell of the grid, and connect it right away.
+ * The stream takes the site over */
+static VideoStream *stream_add (CustomData *data, StreamSite *site, GError **error) {
+  VideoStream *stream;
+  guint row, column;
+
+  if (!layout_free_cell (data, &row, &column)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "no free tile left in the compositor grid, a larger one needs a restart");
+    site_free (site);
+    return NULL;
+  }
+  stream = stream_new (data, site);
+  stream->row = row;
+  stream->column = column;
+  if (use_compositor ? !compositor_add_tile (data, stream) : !stream_create_display (stream)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "unable to create the tile of stream %s", site->name);
+    stream_remove (data, stream);
+    return NULL;
+  }
+  streams_append (data, stream);
+  if (use_compositor) {
+    /* All cells of the grid are drawn at the same size */
+    VideoStream *other = g_ptr_array_index (data->streams, 0);
+
+    stream_set_size (stream, other->tileWidth, other->tileHeight);
+  } else {
+    /* The drawing area is realized right away, the display pipeline gets its window handle before it plays */
+    tile_create_widget (data, stream);
+    gtk_widget_show (stream->widget);
+    if (gst_element_set_state (stream->display, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "unable to set the display pipeline of stream %s to the playing state", site->name);
+      stream_remove (data, stream);
+      return NULL;
+    }
+  }
+  tiles_update_visibility (data);
+  g_print ("Stream %s added at row %u, column %u\n", site->name, row, column);
+  if (stream->relay && data->server)
+    relay_mount (data, stream);
+  else if (stream->relay)
+    g_printerr ("Stream %s is not relayed, the rtsp server is not running\n", site->name);
+  stream_invoke (stream, (GSourceFunc) rtsp_client, stream, NULL);
+  return stream;
+}
+
+/* A latency set by a control command, and the stream it is for */
+typedef struct _StreamLatency {
+  VideoStream *stream;
+  guint latency;
+} StreamLatency;
+
+/* Runs on the control thread. The adaptive latency controller goes on from the latency set */
+static gboolean stream_latency_cb (StreamLatency *request) {
+  g_print ("Latency of stream %s set to %u ms\n", request->stream->site->name, request->latency);
+  stream_set_latency (request->stream, request->latency);
+  request->stream->quietWindows = 0;
+  return FALSE;
+}
+
+/* One client of the control socket. Its commands are read one line at a time, the next one once the reply is out */
+typedef struct _ControlClient {
+  GSocketConnection *connection;
+  GDataInputStream *input;
+  gboolean pending;               /* The command replies later, see control_reply */
+  gchar *reply;                   /* Reply being sent, NULL if none */
+  CustomData *data;
+} ControlClient;
+
+/* Runs a control command. argv holds the command and its arguments. Appends the lines of the reply to reply,
+ * or returns FALSE with error set */
+typedef gboolean (*ControlFunc) (ControlClient *client, gchar **argv, GString *reply, GError **error);
+
+/* A command of the control socket */
+typedef struct _ControlCommand {
+  const gchar *name;
+  guint min_args;                 /* Arguments after the name */
+  guint max_args;
+  const gchar *usage;
+  ControlFunc func;
+} ControlCommand;
+
+static void control_read (ControlClient *client);
+
+static void control_client_free (ControlClient *client) {
+  g_io_stream_close (G_IO_STREAM (client->connection), NULL, NULL);
+  g_object_unref (client->input);
+  g_object_unref (client->connection);
+  g_free (client->reply);
+  g_free (client);
+}
+
+/* The reply is out: read the next command. A client that went away is closed */
+static void control_written_cb (GOutputStream *output, GAsyncResult *result, ControlClient *client) {
+  GError *error = NULL;
+
+  if (!g_output_stream_write_all_finish (output, result, NULL, &error)) {
+    g_printerr ("Unable to reply to a control command: %s\n", error->message);
+    g_clear_error (&error);
+    control_client_free (client);
+    return;
+  }
+  g_clear_pointer (&client->reply, g_free);
+  client->pending = FALSE;
+  control_read (client);
+}
+
+/* Send the reply to a command: its lines, then OK, or ERROR and the message. Then read the next command. The reply is
+ * sent without blocking the main loop, the command stays pending until it is out */
+static void control_reply (ControlClient *client, const gchar *reply, const GError *failure) {
+  GOutputStream *output = g_io_stream_get_output_stream (G_IO_STREAM (client->connection));
+
+  if (failure)
+    client->reply = g_strdup_printf ("%sERROR %s\n", reply, failure->message);
+  else
+    client->reply = g_strdup_printf ("%sOK\n", reply);
+  client->pending = TRUE;
+  g_output_stream_write_all_async (output, client->reply, strlen (client->reply), G_PRIORITY_DEFAULT, NULL,
+      (GAsyncReadyCallback) control_written_cb, client);
+}
+
+static VideoStream *control_find_stream (CustomData *data, const gchar *name, GError **error) {
+  guint i;
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    if (g_strcmp0 (stream->site->name, name) == 0)
+      return stream;
+  }
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no stream %s", name);
+  return NULL;
+}
+
+/* state [NAME]: one line per stream. The values are snapshots, the control threads may be changing them */
+static gboolean control_state (ControlClient *client, gchar **argv, GString *reply, GError **error) {
+  CustomData *data = client->data;
+  guint i;
+
+  if (argv[1] && !control_find_stream (data, argv[1], error))
+    return FALSE;
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    if (argv[1] && g_strcmp0 (stream->site->name, argv[1]) != 0)
+      continue;
+    g_string_append_printf (reply, "%s location=%s row=%u column=%u state=%s live=%d visible=%d latency=%" G_GUINT64_FORMAT
+        " fps=%" G_GUINT64_FORMAT " reconnects=%" G_GUINT64_FORMAT " stalls=%" G_GUINT64_FORMAT " age=%" G_GUINT64_FORMAT " record=%d\n", stream->site->name, stream->site->location,
+        stream->row, stream->column, gst_element_state_get_name (stream->stateStream), g_atomic_int_get (&stream->showLive),
+        g_atomic_int_get (&stream->decoding) != DECODE_NONE, METRIC_GET (stream->metrics.latency), METRIC_GET (stream->metrics.fps),
+        METRIC_GET (stream->metrics.reconnects), METRIC_GET (stream->metrics.stalls), METRIC_GET (stream->metrics.age) / 1000,
+        stream->site->record);
+  }
+  return TRUE;
+}
+
+/* add NAME URL: a new tile, with the settings of the command line */
+static gboolean control_add (ControlClient *client, gchar **argv, GString *reply, GError **error) {
+  StreamSite *site;
+
+  if (control_find_stream (client->data, argv[1], NULL)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_EXISTS, "stream %s exists already", argv[1]);
+    return FALSE;
+  }
+  site = site_new (argv[1]);
+  site->location = g_strdup (argv[2]);
+  site_apply_options (site);
+  return stream_add (client->data, site, error) != NULL;
+}
+
+/* remove NAME */
+static gboolean control_remove (ControlClient *client, gchar **argv, GString *reply, GError **error) {
+  VideoStream *stream = control_find_stream (client->data, argv[1], error);
+
+  if (!stream)
+    return FALSE;
+  stream_remove (client->data, stream);
+  return TRUE;
+}
+
+/* swap NAME URL: the tile shows another rtsp url from now on */
+static gboolean control_swap (ControlClient *client, gchar **argv, GString *reply, GError **error) {
+  VideoStream *stream = control_find_stream (client->data, argv[1], error);
+  StreamSite *site;
+
+  if (!stream)
+    return FALSE;
+  g_print ("Stream %s switches to %s\n", stream->site->name, argv[2]);
+  site = site_copy (stream->site);
+  g_free (site->location);
+  site->location = g_strdup (argv[2]);
+  stream_restart (stream, site);
+  return TRUE;
+}
+
+/* reconnect NAME: start the stream over with fresh pipelines */
+static gboolean control_reconnect (ControlClient *client, gchar **argv, GString *reply, GError **error) {
+  VideoStream *stream = control_find_stream (client->data, argv[1], error);
+
+  if (!stream)
+    return FALSE;
+  g_print ("Reconnecting stream %s\n", stream->site->name);
+  stream_restart (stream, site_copy (stream->site));
+  return TRUE;
+}
+
+/* latency NAME MS */
+static gboolean control_latency (ControlClient *client, gchar **argv, GString *reply, GError **error) {
+  VideoStream *stream = control_find_stream (client->data, argv[1], error);
+  StreamLatency *request;
+  guint64 latency;
+
+  if (!stream || !g_ascii_string_to_unsigned (argv[2], 10, 0, G_MAXINT, &latency, error))
+    return FALSE;
+  request = g_new0 (StreamLatency, 1);
+  request->stream = stream;
+  request->latency = latency;
+  stream_invoke (stream, (GSourceFunc) stream_latency_cb, request, g_free);
+  return TRUE;
+}
+
+static void control_saved_cb (GObject *source, GAsyncResult *result, ControlClient *client) {
+  GError *error = NULL;
+  gchar *path = record_save_finish (result, &error);
+  gchar *reply = g_strdup_printf ("%s\n", path ? path : "");
+
+  control_reply (client, path ? reply : "", error);
+  g_clear_error (&error);
+  g_free (reply);
+  g_free (path);
+}
+
+/* record NAME [SECONDS]: save the end of the recording of the stream, replies with the path of the clip once it is written */
+static gboolean control_record (ControlClient *client, gchar **argv, GString *reply, GError **error) {
+  VideoStream *stream = control_find_stream (client->data, argv[1], error);
+  guint64 seconds = record_save_length;
+
+  if (!stream || (argv[2] && !g_ascii_string_to_unsigned (argv[2], 10, 1, record_length, &seconds, error)))
+    return FALSE;
+  if (!stream->site->record) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "stream %s is not recorded", stream->site->name);
+    return FALSE;
+  }
+  client->pending = TRUE;
+  record_save (stream, seconds, (GAsyncReadyCallback) control_saved_cb, client);
+  return TRUE;
+}
+
+static gboolean control_help (ControlClient *client, gchar **argv, GString *reply, GError **error);
+
+static const ControlCommand control_commands[] = {
+  { "state", 0, 1, "state [NAME]", control_state },
+  { "add", 2, 2, "add NAME URL", control_add },
+  { "remove", 1, 1, "remove NAME", control_remove },
+  { "swap", 2, 2, "swap NAME URL", control_swap },
+  { "reconnect", 1, 1, "reconnect NAME", control_reconnect },
+  { "latency", 2, 2, "latency NAME MS", control_latency },
+  { "record", 1, 2, "record NAME [SECONDS]", control_record },
+  { "help", 0, 0, "help", control_help },
+};
+
+static gboolean control_help (ControlClient *client, gchar **argv, GString *reply, GError **error) {
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (control_commands); i++)
+    g_string_append_printf (reply, "%s\n", control_commands[i].usage);
+  return TRUE;
+}
+
+/* Run one command line. Arguments are split like a shell does, so URLs can be quoted */
+static void control_execute (ControlClient *client, const gchar *line) {
+  const ControlCommand *command = NULL;
+  GString *reply = g_string_new (NULL);
+  GError *error = NULL;
+  gchar **argv = NULL;
+  gint argc;
+  guint i;
+
+  if (g_shell_parse_argv (line, &argc, &argv, &error)) {
+    for (i = 0; i < G_N_ELEMENTS (control_commands) && !command; i++)
+      if (g_strcmp0 (argv[0], control_commands[i].name) == 0)
+        command = &control_commands[i];
+    if (!command)
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "unknown command %s, try help", argv[0]);
+    else if ((guint) argc - 1 < command->min_args || (guint) argc - 1 > command->max_args)
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "usage: %s", command->usage);
+    else
+      command->func (client, argv, reply, &error);
+  }
+  if (!client->pending)
+    control_reply (client, reply->str, error);
+  g_clear_error (&error);
+  g_strfreev (argv);
+  g_string_free (reply, TRUE);
+}
+
+static void control_line_cb (GDataInputStream *input, GAsyncResult *result, ControlClient *client) {
+  gchar *line = g_data_input_stream_read_line_finish (input, result, NULL, NULL);
+
+  /* The client is gone */
+  if (!line) {
+    control_client_free (client);
+    return;
+  }
+  g_strstrip (line);
+  if (*line)
+    control_execute (client, line);
+  else
+    control_read (client);
+  g_free (line);
+}
+
+static void control_read (ControlClient *client) {
+  g_data_input_stream_read_line_async (client->input, G_PRIORITY_DEFAULT, NULL, (GAsyncReadyCallback) control_line_cb, client);
+}
+
+/* A client connected to the control socket. Its commands run on the main thread, like the GUI that shows their effect */
+static gboolean control_incoming_cb (GSocketService *service, GSocketConnection *connection, GObject *source, CustomData *data) {
+  ControlClient *client = g_new0 (ControlClient, 1);
+
+  client->connection = g_object_ref (connection);
+  client->input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+  g_data_input_stream_set_newline_type (client->input, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+  client->data = data;
+  control_read (client);
+  return TRUE;
+}
+
+/* Accept control commands on the control socket, one per line: state, add, remove, swap, reconnect, latency, record */
+static gboolean control_start (CustomData *data) {
+  GSocketAddress *address;
+  GError *error = NULL;
+
+  if (!control_socket)
+    return TRUE;
+  data->control = g_socket_service_new ();
+  /* A socket left behind by an earlier run would make the bind fail */
+  g_unlink (control_socket);
+  address = g_unix_socket_address_new (control_socket);
+  if (!g_socket_listener_add_address (G_SOCKET_LISTENER (data->control), address, G_SOCKET_TYPE_STREAM,
+      G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error)) {
+    g_printerr ("Unable to accept control commands on %s: %s\n", control_socket, error->message);
+    g_clear_error (&error);
+    g_object_unref (address);
+    g_object_unref (data->control);
+    data->control = NULL;
+    return FALSE;
+  }
+  g_object_unref (address);
+  g_signal_connect (data->control, "incoming", G_CALLBACK (control_incoming_cb), data);
+  g_socket_service_start (data->control);
+  g_print ("Control commands accepted on %s\n", control_socket);
+  return TRUE;
+}
+
+static void control_stop (CustomData *data) {
+  if (!data->control)
+    return;
+  g_socket_service_stop (data->control);
+  g_socket_listener_close (G_SOCKET_LISTENER (data->control));
+  g_object_unref (data->control);
+  data->control = NULL;
+  g_unlink (control_socket);
+}
+
+/* Phases of a benchmark run */
+typedef enum {
+  BENCH_STARTUP,                  /* all streams connect at once, until each decoded its first frame */
+  BENCH_STEADY,                   /* frame rate, latency and CPU are measured */
+  BENCH_RECOVERY                  /* every stream lost its connection, until each decoded again */
+} BenchPhase;
+
+/* State of a benchmark run */
+typedef struct _Benchmark {
+  CustomData *app;
+  GMainLoop *loop;
+  GstRTSPServer *server;          /* serves the synthetic streams on localhost */
+  BenchPhase phase;
+  gint64 phaseStart;              /* monotonic time the phase started */
+  clock_t cpuStart;               /* process CPU time at the start of the steady state */
+  gdouble cpu;                    /* CPU of the whole process during the steady state, in percent of one core */
+  gint64 *startup;                /* per stream: microseconds from the start to the first frame, -1 if none */
+  gint64 *recovery;               /* per stream: microseconds from the connection loss to the next first frame, -1 if none */
+  guint64 *decoded;               /* per stream: frames decoded during the steady state */
+} Benchmark;
+
+/* Drop bench_loss percent of the RTP packets the server sends */
+static GstPadProbeReturn bench_loss_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  return g_random_double () * 100 < bench_loss ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+/* A synthetic stream is set up for a client: add the packet loss behind its payloader */
+static void bench_media_configure_cb (GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer user_data) {
+  guint i;
+
+  for (i = 0; i < gst_rtsp_media_n_streams (media); i++) {
+    GstPad *pad = gst_rtsp_stream_get_srcpad (gst_rtsp_media_get_stream (media, i));
+
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, bench_loss_probe_cb, NULL, NULL);
+    gst_object_unref (pad);
+  }
+}
+
+/* Serve bench_streams synthetic streams at /bench0, /bench1, ... on a free port of localhost, returns the port */
+static guint bench_server_start (GstRTSPServer **server) {
+  GstRTSPMountPoints *mounts;
+  gchar *launch;
+  guint i;
+
+  *server = gst_rtsp_server_new ();
+  gst_rtsp_server_set_address (*server, "127.0.0.1");
+  gst_rtsp_server_set_service (*server, "0");
+  mounts = gst_rtsp_server_get_mount_points (*server);
+
+  launch = g_strdup_printf ("( videotestsrc is-live=true pattern=ball ! video/x-raw, width=%d, height=%d, framerate=30/1 ! videoconvert"
+      " ! x264enc tune=zerolatency speed-preset=ultrafast bitrate=%d key-int-max=30 ! video/x-h264, profile=constrained-baseline"
+      " ! rtph264pay name=pay0 pt=96 config-interval=1 )", bench_width, bench_height, bench_bitrate);
+  for (i = 0; i < (guint) bench_streams; i++) {
+    GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new ();
+    gchar *path = g_strdup_printf ("/bench%u", i);
+
+    gst_rtsp_media_factory_set_launch (factory, launch);
+    gst_rtsp_media_factory_set_shared (factory, TRUE);
+    if (bench_loss > 0)
+      g_signal_connect (factory, "media-configure", G_CALLBACK (bench_media_configure_cb), NULL);
+    gst_rtsp_mount_points_add_factory (mounts, path, factory);
+    g_free (path);
+  }
+  g_free (launch);
+  g_object_unref (mounts);
+
+  if (gst_rtsp_server_attach (*server, NULL) == 0)
+    return 0;
+  return gst_rtsp_server_get_bound_port (*server);
+}
+
+/* Microseconds from since to the first frame of the stream after it, -1 if there was none yet */
+static gint64 bench_first_frame (VideoStream *stream, gint64 since) {
+  gint64 first;
+
+  g_mutex_lock (&stream->liveLock);
+  first = stream->firstFrameTime;
+  g_mutex_unlock (&stream->liveLock);
+  return first >= since ? first - since : -1;
+}
+
+/* Runs on the control thread of the stream: its connection is lost */
+static gboolean bench_drop_cb (VideoStream *stream) {
+  if (stream->videoStream)
+    stream_connection_lost (stream, stream->videoStream);
+  return FALSE;
+}
+
+/* Record the first frames of the phase, TRUE once every stream has one */
+static gboolean bench_collect_first_frames (Benchmark *bench, gint64 *results) {
+  gboolean all = TRUE;
+  guint i;
+
+  for (i = 0; i < bench->app->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (bench->app->streams, i);
+
+    if (results[i] < 0)
+      results[i] = bench_first_frame (stream, bench->phaseStart);
+    if (results[i] < 0)
+      all = FALSE;
+  }
+  return all;
+}
+
+static gint bench_compare (gconstpointer a, gconstpointer b) {
+  guint64 va = *(const guint64 *) a, vb = *(const guint64 *) b;
+
+  return va < vb ? -1 : va > vb;
+}
+
+/* The given percentile of sorted latencies in milliseconds */
+static gdouble bench_percentile (GArray *sorted, guint percentile) {
+  return g_array_index (sorted, guint64, (sorted->len - 1) * percentile / 100) / 1000.0;
+}
+
+/* Print the results of all phases. Returns the exit code: 0 if every stream started and recovered */
+static gint bench_report (Benchmark *bench) {
+  CustomData *data = bench->app;
+  gint result = 0;
+  guint i;
+
+  g_print ("\nBenchmark: %u streams of %dx%d at %d kbit/s, %.1f %% packet loss, %d s steady state\n",
+      data->streams->len, bench_width, bench_height, bench_bitrate, bench_loss, bench_duration);
+  g_print ("%-10s %12s %12s %8s %28s\n", "stream", "startup ms", "recovery ms", "fps", "latency p50/p90/p99 ms");
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+    gchar *latency;
+
+    g_mutex_lock (&stream->liveLock);
+    g_array_sort (stream->latencies, bench_compare);
+    if (stream->latencies->len)
+      latency = g_strdup_printf ("%.1f/%.1f/%.1f", bench_percentile (stream->latencies, 50),
+          bench_percentile (stream->latencies, 90), bench_percentile (stream->latencies, 99));
+    else
+      latency = g_strdup ("n/a");
+    g_mutex_unlock (&stream->liveLock);
+
+    g_print ("%-10s %12.0f %12.0f %8.1f %28s\n", stream->site->name,
+        bench->startup[i] < 0 ? -1 : bench->startup[i] / 1000.0, bench->recovery[i] < 0 ? -1 : bench->recovery[i] / 1000.0,
+        (gdouble) bench->decoded[i] / bench_duration, latency);
+    g_free (latency);
+    if (bench->startup[i] < 0 || bench->recovery[i] < 0)
+      result = 1;
+  }
+  g_print ("CPU: %.1f %% of one core, %.1f %% per stream, including the synthetic sources\n",
+      bench->cpu, bench->cpu / MAX (data->streams->len, 1));
+  if (result)
+    g_printerr ("Some streams did not start or did not recover (-1 above)\n");
+  return result;
+}
+
+/* Drives the benchmark through its phases, every 100 ms */
+static gboolean bench_tick_cb (Benchmark *bench) {
+  CustomData *data = bench->app;
+  gint64 now = g_get_monotonic_time ();
+  guint i;
+
+  switch (bench->phase) {
+    case BENCH_STARTUP:
+      if (!bench_collect_first_frames (bench, bench->startup) && now - bench->phaseStart < BENCH_PHASE_TIMEOUT * G_USEC_PER_SEC)
+        break;
+      g_print ("Measuring the steady state for %d s\n", bench_duration);
+      for (i = 0; i < data->streams->len; i++) {
+        VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+        g_mutex_lock (&stream->liveLock);
+        g_array_set_size (stream->latencies, 0);
+        g_mutex_unlock (&stream->liveLock);
+        bench->decoded[i] = METRIC_GET (stream->metrics.decoded);
+      }
+      bench->cpuStart = clock ();
+      bench->phase = BENCH_STEADY;
+      bench->phaseStart = now;
+      break;
+
+    case BENCH_STEADY:
+      if (now - bench->phaseStart < bench_duration * G_USEC_PER_SEC)
+        break;
+      bench->cpu = 100.0 * (clock () - bench->cpuStart) / CLOCKS_PER_SEC / ((now - bench->phaseStart) / (gdouble) G_USEC_PER_SEC);
+      for (i = 0; i < data->streams->len; i++) {
+        VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+        bench->decoded[i] = METRIC_GET (stream->metrics.decoded) - bench->decoded[i];
+      }
+      /* Every stream loses its connection at once, the way a network outage looks to the client */
+      g_print ("Dropping all connections\n");
+      bench->phase = BENCH_RECOVERY;
+      bench->phaseStart = g_get_monotonic_time ();
+      for (i = 0; i < data->streams->len; i++) {
+        VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+        stream_invoke (stream, (GSourceFunc) bench_drop_cb, stream, NULL);
+      }
+      break;
+
+    case BENCH_RECOVERY:
+      if (!bench_collect_first_frames (bench, bench->recovery) && now - bench->phaseStart < BENCH_PHASE_TIMEOUT * G_USEC_PER_SEC)
+        break;
+      g_main_loop_quit (bench->loop);
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* --benchmark: connect the live stream pipelines, without any display, to synthetic streams served by an in-process
+ * rtsp server and report startup time, frame rate, latency, CPU and the recovery from a connection loss */
+static gint benchmark_run (void) {
+  CustomData data;
+  Benchmark bench;
+  guint port, i;
+  gint result;
+
+  if (bench_streams < 1 || bench_duration < 1) {
+    g_printerr ("The benchmark needs at least one stream and one second\n");
+    return -1;
+  }
+  memset (&data, 0, sizeof (data));
+  g_mutex_init (&data.streamsLock);
+  memset (&bench, 0, sizeof (bench));
+  data.duration = GST_CLOCK_TIME_NONE;
+  data.streams = g_ptr_array_new_with_free_func ((GDestroyNotify) stream_free);
+  bench.app = &data;
+
+  port = bench_server_start (&bench.server);
+  if (port == 0) {
+    g_printerr ("Unable to start the benchmark rtsp server\n");
+    g_object_unref (bench.server);
+    g_ptr_array_unref (data.streams);
+    return -1;
+  }
+
+  bench.startup = g_new (gint64, bench_streams);
+  bench.recovery = g_new (gint64, bench_streams);
+  bench.decoded = g_new0 (guint64, bench_streams);
+  for (i = 0; i < (guint) bench_streams; i++) {
+    gchar *name = g_strdup_printf ("bench%u", i);
+    StreamSite *site = site_new (name);
+    VideoStream *stream;
+
+    site->location = g_strdup_printf ("rtsp://127.0.0.1:%u/%s", port, name);
+    site_apply_options (site);
+    stream = stream_new (&data, site);
+    streams_append (&data, stream);
+    stream->latencies = g_array_new (FALSE, FALSE, sizeof (guint64));
+    bench.startup[i] = -1;
+    bench.recovery[i] = -1;
+    g_free (name);
+  }
+  metrics_start (&data);
+
+  /* All streams connect at once */
+  g_print ("Benchmarking %d streams served at rtsp://127.0.0.1:%u/bench*\n", bench_streams, port);
+  bench.phase = BENCH_STARTUP;
+  bench.phaseStart = g_get_monotonic_time ();
+  for (i = 0; i < data.streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data.streams, i);
+
+    stream_invoke (stream, (GSourceFunc) rtsp_client, stream, NULL);
+  }
+  g_timeout_add (100, (GSourceFunc) bench_tick_cb, &bench);
+
+  bench.loop = g_main_loop_new (NULL, FALSE);
+  g_main_loop_run (bench.loop);
+  result = bench_report (&bench);
+
+  metrics_stop (&data);
+  g_ptr_array_unref (data.streams);
+  g_main_loop_unref (bench.loop);
+  g_object_unref (bench.server);
+  g_free (bench.startup);
+  g_free (bench.recovery);
+  g_free (bench.decoded);
+  return result;
+}
+
+/* State of a soak test */
+typedef struct _Soak {
+  CustomData *app;
+  GMainLoop *loop;
+  gint cycle;                     /* cycles started so far */
+  glong rss;                      /* resident memory in KiB and open file descriptors after the warmup */
+  guint fds;
+  gint result;                    /* exit code */
+} Soak;
+
+/* Resident memory of the process in KiB and its open file descriptors, read from /proc. FALSE without /proc */
+static gboolean soak_sample (glong *rss, guint *fds) {
+  gchar *statm;
+  gchar **fields;
+  GDir *dir;
+
+  if (!g_file_get_contents ("/proc/self/statm", &statm, NULL, NULL))
+    return FALSE;
+  fields = g_strsplit (statm, " ", 3);
+  *rss = fields[0] && fields[1] ? g_ascii_strtoll (fields[1], NULL, 10) * (sysconf (_SC_PAGESIZE) / 1024) : 0;
+  g_strfreev (fields);
+  g_free (statm);
+
+  dir = g_dir_open ("/proc/self/fd", 0, NULL);
+  if (!dir)
+    return FALSE;
+  for (*fds = 0; g_dir_read_name (dir); (*fds)++);
+  g_dir_close (dir);
+  return TRUE;
+}
+
+/* Runs on the control thread of the stream: the connection of the last cycle is lost, whether it got anywhere or not,
+ * and the next one starts right away instead of after the backoff delay. It goes through the same pipeline lifecycle
+ * as any reconnect, including the rebuild after PIPELINE_REUSE_MAX connects */
+static gboolean soak_cycle_cb (VideoStream *stream) {
+  GstElement *pipelines[] = { stream->videoStream, stream->standbyStream };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (pipelines); i++) {
+    if (pipelines[i] && GST_STATE_TARGET (pipelines[i]) == GST_STATE_PLAYING)
+      stream_connection_lost (stream, pipelines[i]);
+  }
+  stream_cancel_reconnect (stream);
+  stream->reconnect_delay = RECONNECT_DELAY_MIN;
+  rtsp_client (stream);
+  return FALSE;
+}
+
+/* Starts a cycle on every stream every SOAK_CYCLE_INTERVAL, takes the baseline after SOAK_WARMUP cycles and compares
+ * the end against it */
+static gboolean soak_tick_cb (Soak *soak) {
+  CustomData *data = soak->app;
+  glong rss;
+  guint fds, i;
+
+  if ((soak->cycle == SOAK_WARMUP || soak->cycle == soak_cycles || soak->cycle % MAX (soak_cycles / 10, 1) == 0) &&
+      !soak_sample (&rss, &fds)) {
+    g_printerr ("Unable to read the memory and file descriptors of the process from /proc\n");
+    soak->result = -1;
+    g_main_loop_quit (soak->loop);
+    return FALSE;
+  }
+  if (soak->cycle == SOAK_WARMUP) {
+    soak->rss = rss;
+    soak->fds = fds;
+  }
+  if (soak->cycle % MAX (soak_cycles / 10, 1) == 0)
+    g_print ("Cycle %d of %d: %ld KiB resident, %u file descriptors\n", soak->cycle, soak_cycles, rss, fds);
+
+  if (soak->cycle == soak_cycles) {
+    guint64 decoded = 0;
+
+    for (i = 0; i < data->streams->len; i++)
+      decoded += METRIC_GET (((VideoStream *) g_ptr_array_index (data->streams, i))->metrics.decoded);
+    g_print ("\nSoak: %d connect/fail cycles of %u streams, %" G_GUINT64_FORMAT " frames decoded\n"
+        "Resident memory %ld -> %ld KiB (%+ld), file descriptors %u -> %u (%+d)\n",
+        soak_cycles, data->streams->len, decoded, soak->rss, rss, rss - soak->rss, soak->fds, fds, (gint) fds - (gint) soak->fds);
+    if (rss - soak->rss > SOAK_RSS_SLACK || (gint) fds - (gint) soak->fds > SOAK_FD_SLACK) {
+      g_printerr ("Memory or file descriptors grew over the cycles (allowed: %d KiB, %d descriptors)\n", SOAK_RSS_SLACK, SOAK_FD_SLACK);
+      soak->result = 1;
+    } else if (decoded == 0) {
+      g_printerr ("No stream ever decoded a frame, the cycles did not connect\n");
+      soak->result = 1;
+    }
+    g_main_loop_quit (soak->loop);
+    return FALSE;
+  }
+
+  for (i = 0; i < data->streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data->streams, i);
+
+    stream_invoke (stream, (GSourceFunc) soak_cycle_cb, stream, NULL);
+  }
+  /* The waiting video is switched on and off the way placeholder_update does when the tiles go live and back */
+  gst_element_set_state (data->placeholder, soak->cycle % 2 ? GST_STATE_PLAYING : GST_STATE_PAUSED);
+  soak->cycle++;
+  return TRUE;
+}
+
+/* --soak: force soak_cycles connect/fail cycles of the live stream pipelines, without any display, against the
+ * synthetic streams of an in-process rtsp server. Every other stream points at a mount the server does not have, so
+ * its connects fail with an error, the others are dropped wherever they got to in the cycle. The waiting video runs
+ * as well and is paused and resumed every cycle. Fails if the resident memory or the file descriptors of the process
+ * grew over the cycles */
+static gint soak_run (void) {
+  CustomData data;
+  GstRTSPServer *server;
+  Soak soak;
+  guint port, i;
+
+  if (bench_streams < 1 || soak_cycles < SOAK_WARMUP * 2) {
+    g_printerr ("The soak test needs at least one stream and %d cycles\n", SOAK_WARMUP * 2);
+    return -1;
+  }
+  memset (&data, 0, sizeof (data));
+  g_mutex_init (&data.streamsLock);
+  memset (&soak, 0, sizeof (soak));
+  data.duration = GST_CLOCK_TIME_NONE;
+  data.streams = g_ptr_array_new_with_free_func ((GDestroyNotify) stream_free);
+  soak.app = &data;
+
+  port = bench_server_start (&server);
+  if (port == 0) {
+    g_printerr ("Unable to start the soak test rtsp server\n");
+    g_object_unref (server);
+    g_ptr_array_unref (data.streams);
+    return -1;
+  }
+  for (i = 0; i < (guint) bench_streams; i++) {
+    gchar *name = g_strdup_printf ("soak%u", i);
+    StreamSite *site = site_new (name);
+
+    site->location = g_strdup_printf ("rtsp://127.0.0.1:%u/%s%u", port, i % 2 ? "missing" : "bench", i);
+    site_apply_options (site);
+    streams_append (&data, stream_new (&data, site));
+    g_free (name);
+  }
+  if (!placeholder_create (&data)) {
+    g_ptr_array_unref (data.streams);
+    g_object_unref (server);
+    return -1;
+  }
+
+  g_print ("Soaking %d streams served at rtsp://127.0.0.1:%u for %d cycles of %d ms\n", bench_streams, port,
+      soak_cycles, SOAK_CYCLE_INTERVAL);
+  g_timeout_add (SOAK_CYCLE_INTERVAL, (GSourceFunc) soak_tick_cb, &soak);
+  soak.loop = g_main_loop_new (NULL, FALSE);
+  g_main_loop_run (soak.loop);
+
+  gst_element_set_state (data.placeholder, GST_STATE_NULL);
+  pipeline_unwatch_errors (data.placeholder);
+  gst_object_unref (data.placeholder);
+  g_ptr_array_unref (data.streams);
+  g_main_loop_unref (soak.loop);
+  g_object_unref (server);
+  return soak.result;
+}
+
+int main(int argc, char *argv[]) {
+  CustomData data;
+  GOptionContext *context;
+  GOptionGroup *group;
+  GKeyFile *key_file;
+  GPtrArray *sites = NULL;
+  GPtrArray *mounts = NULL;
+  GError *error=NULL;
+  gboolean relayed;
+  guint i;
+
+  startup_time = g_get_monotonic_time ();
+
+  /* Parse the command line, this also initializes GTK and GStreamer. The display is only opened
+   * when there is a video wall to show, the benchmark and the soak test run headless */
+  context = g_option_context_new ("- video wall for the live streams of all sites");
+  g_option_context_add_main_entries (context, entries, NULL);
+  group = g_option_group_new ("benchmark", "Benchmark Options:", "Show benchmark options", NULL, NULL);
+  g_option_group_add_entries (group, bench_entries);
+  g_option_context_add_group (context, group);
+  g_option_context_add_group (context, gtk_get_option_group (FALSE));
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_clear_error (&error);
+    g_option_context_free (context);
+    return -1;
+  }
+  g_option_context_free (context);
+  if (!benchmark && !soak_cycles && !gtk_init_check (&argc, &argv)) {
+    g_printerr ("Unable to open the display\n");
+    return -1;
+  }
+
+  /* Load the configuration, the command line options given take precedence */
+  key_file = config_open (&error);
+  if (!key_file || !config_load_general (key_file, &error) || !(sites = config_load_sites (key_file, &error)) ||
+      (use_server && !(mounts = config_load_mounts (key_file, &error)))) {
+    g_printerr ("Unable to load the configuration: %s\n", error->message);
+    g_clear_error (&error);
+    if (key_file)
+      g_key_file_free (key_file);
+    if (sites)
+      g_ptr_array_unref (sites);
+    return -1;
+  }
+  config_running = key_file;
+  if (no_data_timeout < 0)
+    no_data_timeout = NO_DATA_TIMEOUT;
+  if (stall_timeout < 0)
+    stall_timeout = STALL_TIMEOUT;
+
+  /* Find the decoders that work on this machine, fastest first */
+  if (!decoders_probe ())
+    return -1;
+  scaler_choose ();
+  if (use_sync && !sync_clock_create ())
+    return -1;
+
+  if (benchmark || soak_cycles) {
+    g_ptr_array_unref (sites);
+    if (mounts)
+      g_ptr_array_unref (mounts);
+    return benchmark ? benchmark_run () : soak_run ();
+  }
+
+  /* Initialize our data structure */
+  memset (&data, 0, sizeof (data));
+  g_mutex_init (&data.streamsLock);
+  data.duration = GST_CLOCK_TIME_NONE;
+  data.streams = g_ptr_array_new_with_free_func ((GDestroyNotify) stream_free);
+
+  /* One stream per site, in window mode each with its own display pipeline and window.
+   * The streams take the sites over */
+  g_ptr_array_set_free_func (sites, NULL);
+  for (i = 0; i < sites->len; i++) {
+    VideoStream *stream = stream_new (&data, g_ptr_array_index (sites, i));
+
+    streams_append (&data, stream);
+    if (!use_compositor && !stream_create_display (stream)) {
+      g_ptr_array_unref (data.streams);
+      return -1;
+    }
+  }
+  g_ptr_array_unref (sites);
+
+  /* Connect all streams at once on their control threads, the rtsp handshakes run while the waiting video, the GL
+   * context and the GUI are set up. Streams with a startup delay get their pipeline ready for it right away */
+  for (i = 0; i < data.streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data.streams, i);
+
+    stream_invoke (stream, (GSourceFunc) stream_connect_cb, stream, NULL);
+  }
+
+  /* The waiting video is decoded once for all tiles */
+  if (!placeholder_create (&data)) {
+    g_ptr_array_unref (data.streams);
+    return -1;
+  }
+
+  /* In compositor mode all tiles are rendered by one mixer pipeline */
+  if (use_compositor && !compositor_create (&data)) {
+    g_ptr_array_unref (data.streams);
+    return -1;
+  }
+
+  /* Create the GUI */
+  create_ui (&data);
+
+  if (use_compositor && gst_element_set_state (data.compositor, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    g_printerr ("Unable to set the compositor pipeline to the playing state.\n");
+    g_ptr_array_unref (data.streams);
+    gst_object_unref (data.compositor);
+    return -1;
+  }
+
+  /* Start playing the tiles, their sinks got the window handles in realize_cb */
+  for (i = 0; i < data.streams->len; i++) {
+    VideoStream *stream = g_ptr_array_index (data.streams, i);
+
+    if (stream->display && gst_element_set_state (stream->display, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+      g_printerr ("Unable to set the display pipeline of stream %s to the playing state.\n", stream->site->name);
+      g_ptr_array_unref (data.streams);
+      return -1;
+    }
+  }
+  if (gst_element_set_state (data.placeholder, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    g_printerr ("Unable to set the waiting video pipeline to the playing state.\n");
+    g_ptr_array_unref (data.streams);
+    return -1;
+  }
+
+  /* Watch all tiles for live streams that stopped delivering frames */
+  data.no_data_check = g_timeout_add (NO_DATA_CHECK_INTERVAL, (GSourceFunc) no_data_check_cb, &data);
+
+  /* Telemetry of all streams and the control commands, a node that cannot serve them still shows the video wall */
+  metrics_start (&data);
+  control_start (&data);
+
+  /* Serve the capture devices of this site to the other sites, and the relayed streams to the clients of this site */
+  relayed = FALSE;
+  for (i = 0; i < data.streams->len; i++)
+    relayed |= ((VideoStream *) g_ptr_array_index (data.streams, i))->relay != NULL;
+  if (mounts || relayed)
+    rtsp_server (&data, mounts);
+  if (mounts)
+    g_ptr_array_unref (mounts);
+
+  /* Reload the configuration on SIGHUP */
+  g_unix_signal_add (SIGHUP, (GSourceFunc) reload_cb, &data);
+  /* Save the end of the recordings on SIGUSR1 */
+  g_unix_signal_add (SIGUSR1, (GSourceFunc) record_signal_cb, &data);
+
+  /* Start the GTK main loop. We will not regain control until gtk_main_quit is called. */
+  gtk_main ();
+
+  /* Free resources, the placeholder goes first so it stops pushing frames into the tiles */
+  rtsp_server_stop (&data);
+  control_stop (&data);
+  metrics_stop (&data);
+  g_source_remove (data.no_data_check);
+  gst_element_set_state (data.placeholder, GST_STATE_NULL);
+  pipeline_unwatch_errors (data.placeholder);
+  gst_object_unref (data.placeholder);
+  g_ptr_array_unref (data.streams);
+  if (data.compositor) {
+    gst_element_set_state (data.compositor, GST_STATE_NULL);
+    gst_object_unref (data.compositor);
+  }
+  if (sync_clock)
+    gst_object_unref (sync_clock);
+  g_key_file_free (config_running);
   return 0;
 }